@@ -0,0 +1,339 @@
+// conversation_bench - wall-clock timings for the Conversation and GeminiClient hot paths
+// Usage: conversation_bench [--sizes 10,1000,100000,1000000] [--out bench_results.json] [--dir <scratch dir>]
+// Synthetic conversations alternate user prompts and longer model replies (markdown, code, non-ASCII text).
+// Results are written as one JSON document: an entry per operation and message count with the number of
+// iterations, mean and best time and the bytes processed. Progress goes to stderr.
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "Conversation.h"
+#include "BinarySession.h"
+#include "ContextWindow.h"
+#include "GeminiClient.h"
+
+using Clock = std::chrono::steady_clock;
+
+// small operations are repeated until this much time was spent on them
+static const double MIN_SAMPLE_SECONDS = 0.5;
+static const size_t MAX_ITERATIONS = 1000;
+// distinct message bodies, reused cyclically so a 1M message history does not need 1M generated strings
+static const size_t CONTENT_POOL = 4096;
+
+static const char *const WORDS[] = {
+    "the", "request", "context", "token", "model", "reply", "function", "memory", "latency", "buffer",
+    "stream", "session", "history", "journal", "snapshot", "compile", "vector", "string", "parse", "naïve",
+    "résumé", "über", "日本語", "テスト", "performance", "example", "because", "however", "return", "value"};
+
+static std::string makeText(std::mt19937 &rng, size_t length, bool markdown)
+{
+    std::uniform_int_distribution<size_t> word(0, sizeof(WORDS) / sizeof(WORDS[0]) - 1);
+    std::uniform_int_distribution<int> roll(0, 99);
+    std::string text;
+    text.reserve(length + 32);
+    while (text.size() < length)
+    {
+        int r = roll(rng);
+        if (markdown && r < 2)
+        {
+            text += "\n\n```cpp\nstd::string s = \"quoted\\tvalue\";\nreturn s.size();\n```\n\n";
+        }
+        else if (r < 6)
+        {
+            text += ".\n";
+        }
+        else if (r < 8)
+        {
+            text += ", \"quoted\" ";
+        }
+        else
+        {
+            if (!text.empty() && text.back() != '\n')
+                text += ' ';
+            text += WORDS[word(rng)];
+        }
+    }
+    return text;
+}
+
+// User prompts are short (median ~150 bytes), model replies longer (median ~600 bytes), both long-tailed
+static std::vector<std::string> makeContentPool()
+{
+    std::mt19937 rng(42);
+    std::lognormal_distribution<double> userLength(std::log(150.0), 0.8);
+    std::lognormal_distribution<double> modelLength(std::log(600.0), 0.8);
+    std::vector<std::string> pool;
+    pool.reserve(CONTENT_POOL);
+    for (size_t i = 0; i < CONTENT_POOL; ++i)
+    {
+        bool model = i % 2 == 1;
+        double length = model ? modelLength(rng) : userLength(rng);
+        pool.push_back(makeText(rng, std::min<size_t>(static_cast<size_t>(length), 16384), model));
+    }
+    return pool;
+}
+
+static void fillConversation(Conversation &convo, const std::vector<std::string> &pool, size_t count)
+{
+    // one message a minute, starting at a fixed date so runs are comparable
+    const int64_t start = 1700000000;
+    for (size_t i = 0; i < count; ++i)
+    {
+        convo.addMessage(i % 2 == 0 ? Role::user : Role::model, pool[i % pool.size()],
+                         start + static_cast<int64_t>(i) * 60);
+    }
+}
+
+static size_t contentBytes(const Conversation &convo)
+{
+    size_t total = 0;
+    for (const Message &msg : convo.getMessages())
+        total += msg.content.size();
+    return total;
+}
+
+// Gemini generateContent response carrying a reply of about the given size
+static std::string makeResponse(const std::vector<std::string> &pool, size_t replyBytes)
+{
+    std::string text;
+    for (size_t i = 1; text.size() < replyBytes; i += 2)
+        text += pool[i % pool.size()];
+    nlohmann::json response = {
+        {"candidates", {{{"content", {{"parts", {{{"text", text}}}}, {"role", "model"}}},
+                         {"finishReason", "STOP"},
+                         {"index", 0}}}},
+        {"usageMetadata", {{"promptTokenCount", 1200}, {"candidatesTokenCount", text.size() / 4}, {"totalTokenCount", 1200 + text.size() / 4}}},
+        {"modelVersion", "gemini-2.5-flash"}};
+    return response.dump();
+}
+
+class Bench
+{
+private:
+    nlohmann::json results = nlohmann::json::array();
+
+public:
+    // Time fn, repeating it while the total stays below MIN_SAMPLE_SECONDS
+    void measure(const std::string &operation, size_t messages, size_t bytes, const std::function<void()> &fn)
+    {
+        std::vector<double> samples;
+        double total = 0;
+        while (samples.empty() || (total < MIN_SAMPLE_SECONDS && samples.size() < MAX_ITERATIONS))
+        {
+            auto begin = Clock::now();
+            fn();
+            double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+            samples.push_back(seconds);
+            total += seconds;
+        }
+
+        double mean = total / samples.size();
+        double best = *std::min_element(samples.begin(), samples.end());
+        nlohmann::json entry = {
+            {"operation", operation},
+            {"messages", messages},
+            {"bytes", bytes},
+            {"iterations", samples.size()},
+            {"mean_ms", mean * 1e3},
+            {"min_ms", best * 1e3},
+            {"mb_per_s", mean > 0 ? bytes / mean / 1e6 : 0.0}};
+        results.push_back(entry);
+
+        std::cerr << "  " << operation << " [" << messages << "]: " << mean * 1e3 << " ms mean, "
+                  << best * 1e3 << " ms best (" << samples.size() << " run(s))\n";
+    }
+
+    const nlohmann::json &getResults() const { return results; }
+};
+
+// loadFromFile reports on stdout; keep that out of the benchmark output
+class QuietStdout
+{
+private:
+    std::streambuf *saved;
+    std::ostringstream sink;
+
+public:
+    QuietStdout() : saved(std::cout.rdbuf(sink.rdbuf())) {}
+    ~QuietStdout() { std::cout.rdbuf(saved); }
+};
+
+static std::vector<size_t> parseSizes(const std::string &text)
+{
+    std::vector<size_t> sizes;
+    std::istringstream iss(text);
+    std::string item;
+    while (std::getline(iss, item, ','))
+    {
+        if (!item.empty())
+            sizes.push_back(std::strtoull(item.c_str(), nullptr, 10));
+    }
+    return sizes;
+}
+
+static void runConversationBenchmarks(Bench &bench, const std::vector<std::string> &pool, size_t count,
+                                      const std::filesystem::path &dir)
+{
+    std::cerr << count << " messages\n";
+
+    Conversation convo;
+    fillConversation(convo, pool, count);
+    const size_t content = contentBytes(convo);
+
+    bench.measure("addMessage", count, content, [&]
+                  {
+        Conversation scratch;
+        fillConversation(scratch, pool, count); });
+
+    nlohmann::json snapshot;
+    bench.measure("toJson", count, content, [&]
+                  { snapshot = convo.toJson(); });
+    bench.measure("fromJson", count, content, [&]
+                  {
+        Conversation loaded;
+        loaded.fromJson(snapshot); });
+    snapshot = nlohmann::json();
+
+    bench.measure("toGeminiFormat", count, content, [&]
+                  { nlohmann::json request = convo.toGeminiFormat(); });
+    bench.measure("toGeminiFormat+dump", count, content, [&]
+                  { std::string payload = convo.toGeminiFormat().dump(); });
+    bench.measure("toGeminiPayload", count, content, [&]
+                  { std::string payload = convo.toGeminiPayload(); });
+
+    // relevance context: building the BM25 index from scratch, then one turn's query against it
+    bench.measure("RelevanceIndex::add", count, content, [&]
+                  {
+        RelevanceIndex index;
+        for (const Message &msg : convo.getMessages())
+            index.add(msg.content); });
+    convo.relevanceIndex();
+    RelevancePolicy relevance(6, 6);
+    bench.measure("RelevancePolicy::select", count, content, [&]
+                  { ContextSelection selection = relevance.select(convo, 100000); });
+    bench.measure("RelevanceIndex::find", count, content, [&]
+                  { auto hits = convo.relevanceIndex().find("\"session history\" snapshot", 10); });
+
+    const std::string jsonFile = (dir / "bench_history.json").string();
+    bench.measure("saveToFile.json", count, content, [&]
+                  { convo.saveToFile(jsonFile); });
+    const size_t jsonBytes = std::filesystem::file_size(jsonFile);
+    bench.measure("loadFromFile.json", count, jsonBytes, [&]
+                  {
+        QuietStdout quiet;
+        Conversation loaded;
+        loaded.loadFromFile(jsonFile); });
+    std::filesystem::remove(jsonFile);
+
+    const std::string binaryFile = (dir / (std::string("bench_history") + BINARY_SESSION_EXTENSION)).string();
+    bench.measure("saveToFile.gcs", count, content, [&]
+                  { convo.saveToFile(binaryFile); });
+    const size_t binaryBytes = std::filesystem::file_size(binaryFile);
+    bench.measure("loadFromFile.gcs", count, binaryBytes, [&]
+                  {
+        QuietStdout quiet;
+        Conversation loaded;
+        loaded.loadFromFile(binaryFile); });
+    std::filesystem::remove(binaryFile);
+
+    const std::string markdownFile = (dir / "bench_history.md").string();
+    bench.measure("exportToMarkdown", count, content, [&]
+                  { convo.exportToMarkdown(markdownFile); });
+    std::filesystem::remove(markdownFile);
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<size_t> sizes = {10, 1000, 100000, 1000000};
+    std::string outFile = "bench_results.json";
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "conversation_bench";
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--sizes" && i + 1 < argc)
+        {
+            sizes = parseSizes(argv[++i]);
+        }
+        else if (arg == "--out" && i + 1 < argc)
+        {
+            outFile = argv[++i];
+        }
+        else if (arg == "--dir" && i + 1 < argc)
+        {
+            dir = argv[++i];
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--sizes 10,1000,100000,1000000] [--out bench_results.json] [--dir <scratch dir>]\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec)
+    {
+        std::cerr << "Error: cannot create " << dir << ": " << ec.message() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    const std::vector<std::string> pool = makeContentPool();
+    Bench bench;
+
+    try
+    {
+        for (size_t count : sizes)
+        {
+            runConversationBenchmarks(bench, pool, count, dir);
+        }
+
+        // reply parsing depends on the size of one response, not on the history
+        std::cerr << "extractGeminiReply\n";
+        GeminiClient client;
+        for (size_t replyBytes : {1024, 16 * 1024, 256 * 1024, 4 * 1024 * 1024})
+        {
+            const std::string response = makeResponse(pool, replyBytes);
+            bench.measure("extractGeminiReply", 1, response.size(), [&]
+                          { std::string reply = client.extractGeminiReply(response); });
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    nlohmann::json report = {
+        {"benchmark", "conversation_bench"},
+        {"timestamp", static_cast<int64_t>(std::time(nullptr))},
+        {"compiler", __VERSION__},
+#ifdef NDEBUG
+        {"build", "release"},
+#else
+        {"build", "debug"},
+#endif
+        {"binary_compression", static_cast<int>(defaultCompression())},
+        {"results", bench.getResults()}};
+
+    std::ofstream out(outFile);
+    if (!out)
+    {
+        std::cerr << "Error: cannot write " << outFile << "\n";
+        return EXIT_FAILURE;
+    }
+    out << report.dump(2) << "\n";
+    std::cerr << "Results written to " << outFile << "\n";
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,309 @@
+// load_driver - end-to-end load test of the request path (Conversation + GeminiClient + HTTP)
+// Usage: load_driver [--conversations 32] [--turns 10] [--concurrency 8] [--prompt-bytes 200] [--stream]
+//                    [--policy all|window|pin|summary|relevance] [--context-tokens 100000] [--persist <dir>]
+//                    [--out load_results.json]
+// Each conversation sends --turns synthetic prompts one after another, each with its history as context;
+// up to --concurrency conversations have a request in flight at once. A turn is timed from adding the prompt
+// to storing the reply (and, with --persist, journaling both to <dir>/conv<N>.json). The client is configured
+// from the environment like the CLI; GEMINI_BASE_URL defaults to a mock_gemini on 127.0.0.1:18080 so a
+// forgotten variable never sends a load test to the real API. Prints throughput and turn latency percentiles.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "Conversation.h"
+#include "ContextWindow.h"
+#include "GeminiClient.h"
+#include "Metrics.h"
+
+using Clock = std::chrono::steady_clock;
+
+static const char *const WORDS[] = {
+    "the", "request", "context", "token", "model", "reply", "function", "memory", "latency", "buffer",
+    "stream", "session", "history", "journal", "snapshot", "compile", "vector", "string", "parse", "value"};
+
+struct LoadOptions
+{
+    size_t conversations = 32;
+    size_t turns = 10;
+    size_t concurrency = 8;
+    size_t promptBytes = 200;
+    bool stream = false;
+    std::string policy = "all";
+    size_t contextTokens = 100000;
+    std::string persistDir;
+    std::string outFile;
+};
+
+struct LoadConversation
+{
+    Conversation convo;
+    std::string file;
+    size_t turn = 0;
+    Clock::time_point turnStarted;
+    // written by the worker thread before onDone, read after it
+    Clock::time_point firstChunk;
+    bool sawChunk = false;
+    std::unique_ptr<PendingReply> pending;
+};
+
+static std::string makePrompt(std::mt19937 &rng, size_t length)
+{
+    std::uniform_int_distribution<size_t> word(0, sizeof(WORDS) / sizeof(WORDS[0]) - 1);
+    std::string text;
+    while (text.size() < length)
+    {
+        if (!text.empty())
+            text += ' ';
+        text += WORDS[word(rng)];
+    }
+    return text;
+}
+
+// Exact percentile of sorted samples: nearest rank, as GeminiClient takes the hedge delay
+static double percentile(const std::vector<double> &sorted, double q)
+{
+    if (sorted.empty())
+        return 0;
+    size_t rank = static_cast<size_t>(std::ceil(q * sorted.size()));
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+static nlohmann::json summarize(std::vector<double> &samples)
+{
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for (double ms : samples)
+        sum += ms;
+    return {{"count", samples.size()},
+            {"mean_ms", samples.empty() ? 0 : sum / samples.size()},
+            {"p50_ms", percentile(samples, 0.50)},
+            {"p90_ms", percentile(samples, 0.90)},
+            {"p99_ms", percentile(samples, 0.99)},
+            {"max_ms", samples.empty() ? 0 : samples.back()}};
+}
+
+static bool parseOptions(int argc, char **argv, LoadOptions &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--conversations" && hasValue)
+            options.conversations = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--turns" && hasValue)
+            options.turns = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--concurrency" && hasValue)
+            options.concurrency = std::max<size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+        else if (arg == "--prompt-bytes" && hasValue)
+            options.promptBytes = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--stream")
+            options.stream = true;
+        else if (arg == "--policy" && hasValue)
+            options.policy = argv[++i];
+        else if (arg == "--context-tokens" && hasValue)
+            options.contextTokens = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--persist" && hasValue)
+            options.persistDir = argv[++i];
+        else if (arg == "--out" && hasValue)
+            options.outFile = argv[++i];
+        else
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    LoadOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--conversations 32] [--turns 10] [--concurrency 8] [--prompt-bytes 200] [--stream]"
+                     " [--policy all|window|pin|summary|relevance] [--context-tokens 100000] [--persist <dir>]"
+                     " [--out load_results.json]\n";
+        return 1;
+    }
+
+    // never point a load test at the real API by accident
+    setenv("GEMINI_BASE_URL", "http://127.0.0.1:18080/v1beta", 0);
+    setenv("GEMINI_API_KEY", "load-test", 0);
+    GeminiClient client;
+
+    std::unique_ptr<ContextPolicy> policy = makeContextPolicy(options.policy, 2);
+    if (!policy)
+    {
+        std::cerr << "Error: unknown policy '" << options.policy << "'\n";
+        return 1;
+    }
+
+    std::vector<LoadConversation> conversations(options.conversations);
+    if (!options.persistDir.empty())
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(options.persistDir, ec);
+        for (size_t i = 0; i < conversations.size(); ++i)
+        {
+            conversations[i].file = (std::filesystem::path(options.persistDir) / ("conv" + std::to_string(i) + ".json")).string();
+            bool corrupt = false;
+            if (!conversations[i].convo.openSession(conversations[i].file, corrupt))
+            {
+                std::cerr << "Error: cannot open " << conversations[i].file << "\n";
+                return 1;
+            }
+        }
+    }
+
+    std::cerr << "Load: " << options.conversations << " conversation(s) x " << options.turns << " turn(s), concurrency "
+              << options.concurrency << ", " << (options.stream ? "streaming" : "generateContent") << ", policy "
+              << options.policy << ", base URL " << std::getenv("GEMINI_BASE_URL") << "\n";
+
+    std::mutex finishedMutex;
+    std::condition_variable finishedSignal;
+    std::vector<size_t> finished;
+
+    std::deque<size_t> ready;
+    for (size_t i = 0; i < conversations.size(); ++i)
+        ready.push_back(i);
+
+    std::mt19937 rng(7);
+    std::vector<double> turnLatency;
+    std::vector<double> firstChunkLatency;
+    std::vector<std::string> errors;
+    const size_t total = options.conversations * options.turns;
+    size_t inFlight = 0;
+    size_t completed = 0;
+    const auto started = Clock::now();
+
+    auto advance = [&](size_t index)
+    {
+        LoadConversation &conv = conversations[index];
+        conv.pending.reset();
+        ++completed;
+        if (++conv.turn < options.turns)
+            ready.push_back(index);
+    };
+
+    while (completed < total)
+    {
+        while (inFlight < options.concurrency && !ready.empty())
+        {
+            size_t index = ready.front();
+            ready.pop_front();
+            LoadConversation &conv = conversations[index];
+            conv.turnStarted = Clock::now();
+            conv.sawChunk = false;
+            try
+            {
+                conv.convo.addMessage(Role::user, makePrompt(rng, options.promptBytes));
+                std::string payload = conv.convo.toGeminiPayload(policy->select(conv.convo, options.contextTokens));
+                GeminiClient::ChunkCallback onChunk;
+                if (options.stream)
+                {
+                    onChunk = [&conv](const std::string &)
+                    {
+                        if (!conv.sawChunk)
+                        {
+                            conv.sawChunk = true;
+                            conv.firstChunk = Clock::now();
+                        }
+                    };
+                }
+                conv.pending = client.start(std::move(payload), onChunk, [&, index]()
+                                            {
+                    std::lock_guard<std::mutex> lock(finishedMutex);
+                    finished.push_back(index);
+                    finishedSignal.notify_one(); });
+                ++inFlight;
+            }
+            catch (const std::exception &e)
+            {
+                errors.push_back(e.what());
+                advance(index);
+            }
+        }
+
+        if (inFlight == 0)
+            continue;
+
+        std::vector<size_t> done;
+        {
+            std::unique_lock<std::mutex> lock(finishedMutex);
+            finishedSignal.wait(lock, [&] { return !finished.empty(); });
+            done.swap(finished);
+        }
+
+        for (size_t index : done)
+        {
+            --inFlight;
+            LoadConversation &conv = conversations[index];
+            try
+            {
+                conv.convo.addMessage(Role::model, conv.pending->get());
+                if (!conv.file.empty() && !conv.convo.persist(conv.file))
+                    throw std::runtime_error("persist failed for " + conv.file);
+                turnLatency.push_back(elapsedMs(conv.turnStarted));
+                if (conv.sawChunk)
+                    firstChunkLatency.push_back(std::chrono::duration<double, std::milli>(conv.firstChunk - conv.turnStarted).count());
+            }
+            catch (const std::exception &e)
+            {
+                errors.push_back(e.what());
+            }
+            advance(index);
+        }
+    }
+
+    const double seconds = elapsedMs(started) / 1000.0;
+    nlohmann::json results = {{"conversations", options.conversations},
+                              {"turns", total},
+                              {"failed", errors.size()},
+                              {"concurrency", options.concurrency},
+                              {"stream", options.stream},
+                              {"policy", options.policy},
+                              {"seconds", seconds},
+                              {"turns_per_second", seconds > 0 ? (total - errors.size()) / seconds : 0},
+                              {"turn", summarize(turnLatency)}};
+    if (options.stream)
+        results["first_chunk"] = summarize(firstChunkLatency);
+    results["metrics"] = metrics().toJson();
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "turns:        " << total << " (" << errors.size() << " failed) in " << seconds << " s\n";
+    std::cout << "throughput:   " << results["turns_per_second"].get<double>() << " turns/s\n";
+    std::cout << "turn latency: p50 " << results["turn"]["p50_ms"].get<double>() << " ms, p99 "
+              << results["turn"]["p99_ms"].get<double>() << " ms, max " << results["turn"]["max_ms"].get<double>()
+              << " ms\n";
+    if (options.stream)
+    {
+        std::cout << "first chunk:  p50 " << results["first_chunk"]["p50_ms"].get<double>() << " ms, p99 "
+                  << results["first_chunk"]["p99_ms"].get<double>() << " ms\n";
+    }
+    for (size_t i = 0; i < errors.size() && i < 5; ++i)
+        std::cerr << "error: " << errors[i] << "\n";
+
+    if (!options.outFile.empty())
+    {
+        std::ofstream out(options.outFile, std::ios::trunc);
+        out << results.dump(2) << "\n";
+        if (!out)
+        {
+            std::cerr << "Error: cannot write " << options.outFile << "\n";
+            return 1;
+        }
+    }
+    return errors.empty() ? 0 : 2;
+}
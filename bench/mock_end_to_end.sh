@@ -0,0 +1,95 @@
+#!/bin/sh
+# mock_end_to_end.sh - the request path end to end against mock_gemini, run by ctest
+# Usage: mock_end_to_end.sh <mock_gemini> <load_driver> <persistent_cli>
+# Each step starts a mock on a free port that injects one kind of trouble, runs load_driver or a --batch
+# through it and requires every turn to succeed: 503s and 429s (with a retryDelay) are retried, gzip bodies
+# turned down with 415 are resent as plain JSON, and a slow tail is hedged. The metrics written by
+# load_driver --out must show that the injected case was actually hit.
+set -u
+
+MOCK=$1
+DRIVER=$2
+CLI=$3
+WORK=$(mktemp -d)
+MOCK_PID=
+trap 'stop_mock; rm -rf "$WORK"' EXIT
+
+fail()
+{
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+stop_mock()
+{
+    if [ -n "$MOCK_PID" ]; then
+        kill "$MOCK_PID" 2>/dev/null
+        wait "$MOCK_PID" 2>/dev/null
+        MOCK_PID=
+    fi
+}
+
+# start_mock <mock options...>: exports GEMINI_BASE_URL for the port it picked
+start_mock()
+{
+    stop_mock
+    "$MOCK" --port 0 --latency-ms 5 --chunk-delay-ms 1 "$@" > "$WORK/mock.out" 2>&1 &
+    MOCK_PID=$!
+    PORT=
+    for _ in $(seq 50); do
+        PORT=$(sed -n 's/^mock_gemini listening on 127\.0\.0\.1:\([0-9]*\)$/\1/p' "$WORK/mock.out")
+        [ -n "$PORT" ] && break
+        sleep 0.1
+    done
+    [ -n "$PORT" ] || fail "mock_gemini did not start: $(cat "$WORK/mock.out")"
+    export GEMINI_BASE_URL="http://127.0.0.1:$PORT/v1beta"
+}
+
+# counter <name>: value of a metrics counter in the last load_driver --out file (0 if absent)
+counter()
+{
+    value=$(tr -d ' \n' < "$WORK/results.json" | sed -n "s/.*\"$1\":\([0-9]*\).*/\1/p")
+    echo "${value:-0}"
+}
+
+# drive <step> <load_driver options...>: every turn must succeed
+drive()
+{
+    step=$1
+    shift
+    echo "== $step"
+    "$DRIVER" --out "$WORK/results.json" "$@" || fail "$step: load_driver reported failed turns"
+}
+
+export GEMINI_API_KEY=mock-key
+export GEMINI_RETRY_BASE_MS=10
+export GEMINI_MAX_RETRIES=10
+unset GEMINI_CACHE GEMINI_HEDGE_PERCENTILE GEMINI_TURN_DEADLINE_MS GEMINI_RATE_LIMIT_RPM
+
+start_mock --error-rate 0.1 --rate-limit-rate 0.1 --retry-delay-ms 50
+drive "503 and 429 retries" --conversations 8 --turns 6 --concurrency 4
+[ "$(counter http.retries)" -gt 0 ] || fail "no request was retried"
+[ "$(counter http.throttled)" -gt 0 ] || fail "no 429 retryDelay was honoured"
+drive "streamed replies, journaled" --conversations 8 --turns 6 --concurrency 4 --stream --persist "$WORK/sessions"
+
+start_mock --reject-gzip
+drive "gzip turned down" --conversations 4 --turns 4 --concurrency 2 --prompt-bytes 1500
+[ "$(counter http.gzip_rejected)" -gt 0 ] || fail "no gzip body was sent, so the fallback never ran"
+
+start_mock --slow-rate 0.1 --slow-ms 400
+GEMINI_HEDGE_PERCENTILE=90 GEMINI_HEDGE_MIN_MS=20 \
+    drive "hedged slow tail" --conversations 8 --turns 10 --concurrency 8
+[ "$(counter hedge.fired)" -gt 0 ] || fail "no request was hedged"
+
+start_mock --error-rate 0.1 --rate-limit-rate 0.1 --retry-delay-ms 50
+echo "== batch"
+: > "$WORK/prompts.jsonl"
+for c in 1 2 3 4 5 6; do
+    for t in 1 2 3; do
+        echo "{\"id\": \"c$c-t$t\", \"conversation\": \"c$c\", \"prompt\": \"question $t of conversation $c\"}" >> "$WORK/prompts.jsonl"
+    done
+done
+"$CLI" --batch "$WORK/prompts.jsonl" --out "$WORK/replies.jsonl" --concurrency 4 || fail "batch: some prompts failed"
+[ "$(grep -c '"reply"' "$WORK/replies.jsonl")" -eq 18 ] || fail "batch: expected 18 replies"
+
+echo "all steps passed"
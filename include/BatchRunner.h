@@ -0,0 +1,32 @@
+/*
+BatchRunner.h - Non-interactive batch mode
+Prompts are read from a JSONL file, one object per line:
+
+    {"id": "q1", "conversation": "c1", "prompt": "..."}
+
+Prompts sharing a "conversation" are sent one after another in file order, each with the earlier turns of that
+conversation as context. A prompt without a conversation stands alone. Different conversations run concurrently
+on the client's worker, up to a concurrency limit. Replies are written as JSONL in completion order:
+
+    {"id": "q1", "conversation": "c1", "turn": 0, "reply": "..."}    or    {..., "error": "..."}
+*/
+#pragma once
+
+#include <string>
+#include "ContextWindow.h"
+#include "GeminiClient.h"
+
+struct BatchOptions
+{
+    std::string inputFile;
+    // "" or "-" writes to stdout
+    std::string outputFile;
+    size_t concurrency = 8;
+    // context selection per request; nullptr sends the whole conversation
+    const ContextPolicy *policy = nullptr;
+    size_t contextBudget = 0;
+};
+
+// Run every prompt of the input file; returns the number of failed prompts, or -1 if the input or
+// output file cannot be opened
+int runBatch(GeminiClient &client, const BatchOptions &options);
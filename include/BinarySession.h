@@ -0,0 +1,57 @@
+/*
+BinarySession.h - Compact binary session format (.gcs)
+Versioned, length-prefixed layout with an offset index, as an alternative to the pretty-printed JSON:
+
+    header   "GCSB" | u16 version | u16 reserved | u64 messageCount | u64 generation
+             | u64 summaryCovers | u32 blockCount | u32 summaryLength | u64 indexOffset | summary bytes
+    blocks   records packed into ~256 KiB blocks, each optionally zstd or LZ4 compressed
+    index    per block: u64 offset | u32 storedSize | u32 rawSize | u64 firstMessage | u32 messageCount
+             | u8 codec | 3 bytes padding
+
+A record is u8 role (0 user, 1 model) | i64 timestamp (epoch seconds) | u32 contentLength | content.
+Version 1 files (u8 timestampLength | timestamp text instead of the i64) are still read.
+All integers are little-endian.
+The index lets a reader decode only the blocks it needs, e.g. the newest ones when a session is opened.
+*/
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Conversation.h"
+
+struct LoadedHistory;
+
+enum class Compression : uint8_t
+{
+    none = 0,
+    zstd = 1,
+    lz4 = 2
+};
+
+// Extension used for binary session files
+extern const char *const BINARY_SESSION_EXTENSION;
+
+// True if the codec was compiled in (HAVE_ZSTD / HAVE_LZ4)
+bool compressionAvailable(Compression codec);
+// Best codec compiled in: zstd, then LZ4, then none
+Compression defaultCompression();
+// "none", "zstd" or "lz4"; throws std::invalid_argument for other names
+Compression parseCompression(const std::string &name);
+
+bool isBinarySession(const char *data, size_t size);
+
+// Write messages as a binary session file; throws std::runtime_error on I/O or codec failure
+void writeBinarySession(const std::string &FILENAME, const std::vector<Message> &messages,
+                        const std::string &summary, size_t summaryCovers, uint64_t generation,
+                        Compression codec);
+// The same file contents in memory; throws std::runtime_error on codec failure
+std::string encodeBinarySession(const std::vector<Message> &messages, const std::string &summary,
+                                size_t summaryCovers, uint64_t generation, Compression codec);
+
+// Decode a mapped binary session file; throws std::runtime_error if it is corrupt
+void readBinarySession(const char *data, size_t size, LoadedHistory &out);
+// Decode only the newest blocks, as many as hold at least tail messages (out.first is the first one decoded)
+void readBinarySessionTail(const char *data, size_t size, size_t tail, LoadedHistory &out);
+// Decode the blocks holding messages [begin, end); whole blocks, so out.first may be before begin
+void readBinarySessionRange(const char *data, size_t size, size_t begin, size_t end, LoadedHistory &out);
@@ -1,5 +1,11 @@
 #pragma once
-#include "Conversation.h"
+#include "SessionStore.h"
+#include <iostream>
 #include <string>
 
-bool handleCommand(const std::string& input, Conversation& convo, bool& shouldExit);
\ No newline at end of file
+// Output goes to out / err and confirmations are read from in (the daemon passes one client's streams).
+// False if input is not a command; a command that fails reports why on err.
+bool handleCommand(const std::string& input, SessionStore& store, bool& shouldExit, std::ostream& out = std::cout,
+                   std::ostream& err = std::cerr, std::istream& in = std::cin);
+// Discard the messages of the current session (/clear once confirmed)
+void clearSession(SessionStore& store, std::ostream& out);
\ No newline at end of file
@@ -0,0 +1,93 @@
+/*
+ContextWindow.h - Token budgeted request context
+A ContextPolicy decides which messages of a Conversation are sent with the next request so that the
+request stays within a token budget. Token counts are local estimates cached on each Message.
+*/
+#pragma once
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Conversation.h"
+
+// Fast local estimate (no tokenizer): ~4 ASCII bytes per token, one token per non-ASCII code point
+size_t estimateTokens(std::string_view text);
+
+// Messages selected for one request
+struct ContextSelection
+{
+    // [begin, end) message index ranges, in conversation order
+    std::vector<std::pair<size_t, size_t>> ranges;
+    // sent before the ranges when non-empty (stands in for the messages it covers)
+    std::string summary;
+    size_t tokens = 0;
+    // messages neither sent nor covered by the summary; a summary policy wants these folded in
+    size_t unsummarized = 0;
+};
+
+class ContextPolicy
+{
+public:
+    virtual ~ContextPolicy() = default;
+    virtual const char *name() const = 0;
+    virtual ContextSelection select(const Conversation &convo, size_t budget) const = 0;
+};
+
+// Every message, budget ignored (the original behaviour)
+class FullHistoryPolicy : public ContextPolicy
+{
+public:
+    const char *name() const override { return "all"; }
+    ContextSelection select(const Conversation &convo, size_t budget) const override;
+};
+
+// The most recent messages that fit the budget
+class SlidingWindowPolicy : public ContextPolicy
+{
+public:
+    const char *name() const override { return "window"; }
+    ContextSelection select(const Conversation &convo, size_t budget) const override;
+};
+
+// The first N messages (e.g. instructions given at the start) plus the most recent ones
+class PinFirstPolicy : public ContextPolicy
+{
+private:
+    size_t pinned;
+
+public:
+    explicit PinFirstPolicy(size_t pinned) : pinned(pinned) {}
+    const char *name() const override { return "pin"; }
+    ContextSelection select(const Conversation &convo, size_t budget) const override;
+};
+
+// The stored summary in place of the old messages, plus the most recent ones
+class SummaryPolicy : public ContextPolicy
+{
+public:
+    const char *name() const override { return "summary"; }
+    ContextSelection select(const Conversation &convo, size_t budget) const override;
+};
+
+// The last few messages plus the earlier turns that best match the newest prompt (BM25 over the
+// conversation's RelevanceIndex). A matching message brings its whole turn: the prompt and its reply.
+class RelevancePolicy : public ContextPolicy
+{
+private:
+    size_t turns;
+    size_t recent;
+
+public:
+    RelevancePolicy(size_t turns, size_t recent) : turns(turns), recent(recent) {}
+    const char *name() const override { return "relevance"; }
+    ContextSelection select(const Conversation &convo, size_t budget) const override;
+};
+
+// Build a policy by name ("all", "window", "pin", "summary", "relevance"); returns nullptr for unknown names.
+// relevantTurns / recentMessages only apply to the relevance policy.
+std::unique_ptr<ContextPolicy> makeContextPolicy(const std::string &name, size_t pinned,
+                                                 size_t relevantTurns = 6, size_t recentMessages = 6);
+
+// Request body asking the model to fold messages [from, to) into the existing summary
+std::string buildSummaryRequest(const Conversation &convo, size_t from, size_t to);
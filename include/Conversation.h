@@ -5,9 +5,19 @@ Functions include adding messages, retrieving messages, clearing the conversatio
 */
 #pragma once
 
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <nlohmann/json.hpp>
+#include "Journal.h"
+#include "MappedFile.h"
+#include "RelevanceIndex.h"
+#include "SpillSegment.h"
+#include "StringArena.h"
 
 // Using Enum class for better type safety and readability
 enum class Role
@@ -16,38 +26,181 @@ enum class Role
     model
 };
 
+// Compact message record: the content lives in the owning Conversation's StringArena and the
+// timestamp is kept as epoch seconds (formatted only for display and export).
 struct Message
 {
-    std::string role;
-    std::string content;
-    std::string timestamp;
+    Role role = Role::user;
+    // estimated token count, cached when the message enters the conversation
+    uint32_t tokens = 0;
+    int64_t timestamp = 0;
+    std::string_view content;
 };
 
+struct ContextSelection;
+struct LoadedHistory;
+enum class Compression : uint8_t;
+
 // Conversation class to manage the list of messages and related operations
 class Conversation
 {
 private:
     // Vector to store the messages in the conversation in the order they were added in memory.
-    std::vector<Message> messages;
-    std::string currentTimestamp() const;
-    static std::string roleToString(Role role);
+    // messages[i] is message pagedOut + i (see faultIn); mutable because faulting in happens behind const reads.
+    mutable std::vector<Message> messages;
+    // Owns the text of every message; cleared together with messages
+    mutable StringArena arena;
+
+    // A binary snapshot is opened by decoding only its newest blocks (at least tailMessages messages).
+    // Messages [0, pagedOut) stay in pagedFile until something needs them and faultIn() reads them
+    // through the block index. Callers sharing the conversation with another thread hold its lock.
+    // pagedMap stays mapped so a compaction may replace the file while older messages are still paged out.
+    mutable size_t pagedOut = 0;
+    mutable std::string pagedFile;
+    mutable MappedFile pagedMap;
+    size_t tailMessages = 1000;
+    void faultIn() const;
+    // Decode the paged-out messages [from, to) into loaded (whole blocks); throws if they cannot be read
+    void readPaged(size_t from, size_t to, LoadedHistory &loaded) const;
+    // On failure corrupt is set when the file was read but is not a session (parse or format error)
+    bool loadSnapshot(const std::string &FILENAME, size_t tail, bool &corrupt);
+
+    // Journal state: messages[0..journaledCount) are already on disk (snapshot + journal)
+    Journal journal;
+    uint64_t journalGeneration = 0;
+    uint64_t loadedGeneration = 0;
+    size_t journaledCount = 0;
+    bool journalValid = false;
+    // bumped whenever the history stops matching the journal (cleared, replaced, new summary)
+    uint64_t journalResets = 0;
+    size_t compactThreshold = 256;
+    Compression binaryCompression;
+
+    // Serialized Gemini "contents" entries for all messages, comma separated; appended to on addMessage.
+    // contentOffsets[i] is where message i's entry starts, so any message range is one substring.
+    mutable std::string geminiContents;
+    mutable std::vector<size_t> contentOffsets;
+    void indexMessage(Message &msg) const;
+    void rebuildIndex() const;
+
+    // With a memory limit, the text held in memory (arena + cached entries) is kept below memoryLimit bytes:
+    // the oldest message bodies and their cached entries move to a SpillSegment in spillDir and are read
+    // back through its mapping. messages[0, spilledMessages) point into the segment. The cached entries are
+    // spilledPieces (starting at offsets spilledStarts) followed by geminiContents, which starts at
+    // spilledBytes; contentOffsets count across both.
+    mutable size_t memoryLimit = 0;
+    std::string spillDir;
+    mutable std::unique_ptr<SpillSegment> spill;
+    mutable size_t spilledMessages = 0;
+    mutable std::vector<std::string_view> spilledPieces;
+    mutable std::vector<size_t> spilledStarts;
+    mutable size_t spilledBytes = 0;
+    void enforceMemoryLimit() const;
+    void resetSpill() const;
+    // Append bytes [from, to) of the cached entries to out
+    void appendContents(std::string &out, size_t from, size_t to) const;
+
+    // BM25 index over the message contents; catches up with new messages when it is queried, so histories
+    // that never use the relevance policy do not pay for it
+    mutable RelevanceIndex relevance;
+    // index saved with the snapshot, loaded on first use if it matches (snapshot generation and message count)
+    mutable std::string relevanceFile;
+    size_t relevanceDocuments = 0;
+    void loadSavedIndex() const;
+
+    // Summary standing in for messages [0, summaryCovers) when the context budget is exceeded
+    std::string summary;
+    size_t summaryCovers = 0;
+
+    void adoptHistory(LoadedHistory &&loaded);
 
 public:
-    void addMessage(Role role, const std::string &content);
+    void addMessage(Role role, std::string_view content);
+    void addMessage(Role role, std::string_view content, int64_t timestamp);
+    // Every message, reading any that are still on disk first
     const std::vector<Message> &getMessages() const;
+    // Messages [firstResident(), size()): the recent ones, never read from disk
+    const std::vector<Message> &recentMessages() const;
+    size_t firstResident() const;
+    // Visit messages [from, to) in order without reading the rest of the history: those still on disk are
+    // decoded a few blocks at a time and dropped again. Throws std::runtime_error if they cannot be read.
+    void forEachMessage(size_t from, size_t to, const std::function<void(size_t, const Message &)> &visit) const;
     void clearMessages();
     bool empty() const;
     size_t size() const;
 
+    Conversation();
+    // Messages point into the arena, so a Conversation can be moved but not copied
+    Conversation(Conversation &&) noexcept = default;
+    Conversation &operator=(Conversation &&) noexcept = default;
+    Conversation(const Conversation &) = delete;
+    Conversation &operator=(const Conversation &) = delete;
+
+    static std::string roleToString(Role role);
+    // "user" (any case) is Role::user, everything else is the model
+    static Role roleFromString(std::string_view role);
+
     // Phase 2: Serialization and Deserialization functions
+    // saveToFile writes the binary session format for *.gcs paths and JSON otherwise;
+    // loadFromFile accepts either format.
     nlohmann::json toJson() const;
     void fromJson(const nlohmann::json &jsondata);
     bool saveToFile(const std::string &FILENAME) const;
     bool loadFromFile(const std::string &FILENAME);
 
+    // Phase 5: Append-only journal persistence
+    // openSession loads the snapshot and replays its journal, persist appends only the new messages
+    // and compacts (rewrites the snapshot, truncates the journal) every compactThreshold records.
+    // When openSession fails, corrupt tells a damaged snapshot from one that cannot be read right now
+    // (permissions, out of descriptors or memory).
+    bool openSession(const std::string &FILENAME, bool &corrupt);
+    bool persist(const std::string &FILENAME);
+    bool compact(const std::string &FILENAME);
+
+    // persist() in three steps, so a caller sharing the conversation can write without holding its lock:
+    // prepareSave (locked) copies out the new journal records, or for a compaction the snapshot and search
+    // index bytes; writeSave only touches files; finishSave (locked again) records the outcome.
+    struct PendingSave
+    {
+        std::string path;
+        bool compaction = false;
+        uint64_t generation = 0;
+        std::string records;
+        size_t recordCount = 0;
+        std::string snapshot;
+        std::string searchIndex;
+        // size() and journalResets when prepared
+        size_t upTo = 0;
+        uint64_t resets = 0;
+    };
+    // false if the snapshot could not be encoded
+    bool prepareSave(const std::string &FILENAME, PendingSave &save, bool compaction = false);
+    static bool writeSave(const PendingSave &save);
+    void finishSave(const PendingSave &save, bool written);
+    void setCompactThreshold(size_t records);
+    // Block compression used when writing binary (.gcs) session files
+    void setBinaryCompression(Compression codec);
+    // Messages decoded when openSession finds a binary snapshot; 0 reads the whole snapshot
+    void setTailMessages(size_t count);
+    // Keep at most bytes of message text in memory (0 = no limit), spilling older text to a file in dir
+    void setMemoryLimit(size_t bytes, const std::string &dir);
+
     nlohmann::json toGeminiFormat() const;
+    // Same request body as toGeminiFormat().dump(), assembled from the cached entries without a DOM
+    std::string toGeminiPayload() const;
+    // Request body for the messages chosen by a ContextPolicy
+    std::string toGeminiPayload(const ContextSelection &selection) const;
+
+    // Relevance index covering every message (document i is message i)
+    const RelevanceIndex &relevanceIndex() const;
+
+    const std::string &getSummary() const;
+    size_t summaryCoverage() const;
+    void setSummary(const std::string &text, size_t covers);
 
 
     void printHistory() const;
+    // Messages [from, from + count) in one buffered write; older ones are read from the snapshot for display only
+    void printHistory(size_t from, size_t count, std::ostream &out = std::cout, std::ostream &err = std::cerr) const;
     void exportToMarkdown(const std::string &FILENAME) const;
 };
\ No newline at end of file
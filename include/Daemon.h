@@ -0,0 +1,55 @@
+/*
+Daemon.h - Shared engine process and thin clients over a Unix domain socket
+`persistent_cli --daemon` keeps the session store, the persistence thread and one GeminiClient (with its warm
+connection pool) alive and serves any number of `persistent_cli --attach` clients on one socket. A client
+only forwards the lines typed at its prompt and prints what comes back, so it starts without loading a
+session or opening a connection.
+
+Every message is a frame: a 4-byte big-endian length followed by that many bytes of JSON.
+    client -> daemon   {"op": "line", "text": "..."}    a prompt or a command, as typed
+                       {"op": "input", "text": "..."}   answer to an "input" request (e.g. /clear's y/n)
+                       {"op": "cancel"}                 abort the request in flight
+    daemon -> client   {"type": "output" | "error", "text": "..."}   stdout / stderr text of the line
+                       {"type": "chunk", "text": "..."}             reply text as it streams in
+                       {"type": "input"}                             a command waits for a line of input
+                       {"type": "done", "session": "...", "exit": bool}   the line is finished
+Each connection has its own current session (/switch, /new and /load only change it for that client). Lines
+from different clients run one at a time while they touch the store; waiting for a reply, a summary or a
+client's answer does not block the other clients. Prompts to the same session from two clients take turns,
+each waiting until the previous one has its reply.
+*/
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <nlohmann/json.hpp>
+#include "ContextWindow.h"
+#include "GeminiClient.h"
+#include "SessionStore.h"
+
+struct DaemonOptions
+{
+    std::string socketPath;
+    const ContextPolicy *policy = nullptr;
+    size_t contextBudget = 0;
+    // send reply text as it streams in, otherwise as one chunk
+    bool streamReplies = true;
+    // GEMINI_METRICS_FILE, rewritten after every turn
+    std::string metricsFile;
+};
+
+// GEMINI_DAEMON_SOCKET, or ./data/daemon.sock
+std::string defaultDaemonSocket();
+
+// Serve clients until SIGINT/SIGTERM or a client's /shutdown; pending saves are flushed before returning
+int runDaemon(SessionStore &store, GeminiClient &client, const DaemonOptions &options);
+// Interactive (or piped) prompt that forwards every line to the daemon at socketPath
+int runDaemonClient(const std::string &socketPath);
+
+bool writeFrame(int fd, const nlohmann::json &message);
+// false on end of stream, a short read or a frame that is not JSON
+bool readFrame(int fd, nlohmann::json &message);
+
+// Fold the messages a selection left out of the window into the conversation's summary (one extra request).
+// Used after a turn by the interactive loop and by the daemon.
+void foldIntoSummary(GeminiClient &client, SessionStore &store, Conversation &convo, size_t unsummarized);
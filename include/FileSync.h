@@ -0,0 +1,17 @@
+/*
+FileSync.h - Durable writes
+A write or a rename is only guaranteed to survive a power loss once the file's data and the directory entry
+that names it have reached the disk. The snapshot, journal and index writers call these after writing.
+*/
+#pragma once
+
+#include <string>
+
+// fsync an already written file
+bool syncFile(const std::string &path);
+
+// fsync the directory containing path, making a create or rename inside it durable
+bool syncParentDirectory(const std::string &path);
+
+// Replace path with contents durably: temporary file, fsync, rename, fsync of the directory
+bool replaceFile(const std::string &path, const std::string &contents);
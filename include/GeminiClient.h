@@ -1,15 +1,164 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <vector>
+#include <curl/curl.h>
 #include <nlohmann/json.hpp>
 #include "Conversation.h"
+#include "HttpEngine.h"
+#include "RateLimiter.h"
+#include "ResponseCache.h"
 
+class GeminiClient;
+struct StreamState;
+struct ReplyState;
+
+// Thrown by PendingReply::get when the request was cancelled
+class RequestCancelled : public std::runtime_error {
+public:
+    RequestCancelled() : std::runtime_error("Request cancelled") {}
+};
+
+// An error object returned by the API ({"error": {"code", "status", "message", "details"}})
+class GeminiApiError : public std::runtime_error {
+public:
+    GeminiApiError(const std::string& what, int code, std::string status, std::chrono::milliseconds retryDelay)
+        : std::runtime_error(what), errorCode(code), errorStatus(std::move(status)), delay(retryDelay) {}
+    int code() const { return errorCode; }
+    const std::string& status() const { return errorStatus; }
+    // RetryInfo.retryDelay sent with a 429, 0 if absent
+    std::chrono::milliseconds retryDelay() const { return delay; }
+    // Rate limiting and transient server errors (429, 500, 502, 503, 504)
+    bool retryable() const;
+private:
+    int errorCode;
+    std::string errorStatus;
+    std::chrono::milliseconds delay;
+};
+
+// The error carried by an API response body, nothing if the body is not an error object
+std::optional<GeminiApiError> apiErrorFromBody(const std::string& body);
+
+// A request running on the client's background worker, including its automatic retries
+class PendingReply {
+public:
+    void cancel();
+    // true once the request finished (successfully, with an error or cancelled)
+    bool waitFor(std::chrono::milliseconds timeout) const;
+    size_t bytesReceived() const;
+    // Retries made so far (rate limiting, transient errors)
+    int retries() const;
+    // Blocks until finished; returns the reply text or throws (RequestCancelled, GeminiApiError, transport errors)
+    std::string get();
+private:
+    friend class GeminiClient;
+    PendingReply() = default;
+    // Blocks until the last attempt finished and returns its result
+    const HttpResult& finalResult() const;
+    const GeminiClient* client = nullptr;
+    std::shared_ptr<ReplyState> state;
+};
+
+// GeminiClient submits requests to an HttpEngine worker (curl multi) whose pooled handles keep
+// connections warm across turns (HTTP/2 when the server offers it, cached DNS and TLS sessions).
+// Requests are paced by a token bucket and retried with jittered exponential backoff when the API
+// answers 429/5xx, honouring the retryDelay the server asks for. Large request bodies are sent gzip-encoded
+// (see Gzip.h) unless the endpoint turns them down, and responses may arrive in any encoding curl decodes.
+// With GEMINI_CACHE=on replies are kept in a ResponseCache and a repeated request is answered from disk;
+// GEMINI_CACHE=replay answers only from the cache and never touches the network.
+// With GEMINI_HEDGE_PERCENTILE set, an attempt that has not received its first byte after that percentile of
+// the last 256 first-byte latencies gets a duplicate on a fresh connection; the first of the two to answer is kept
+// and the other is cancelled. GEMINI_TURN_DEADLINE_MS bounds a whole request, retries and hedges included.
 class GeminiClient {
 public:
     GeminiClient();
-    std::string sendMessage(const nlohmann::json& conversation) const;
+    ~GeminiClient();
+    GeminiClient(const GeminiClient&) = delete;
+    GeminiClient& operator=(const GeminiClient&) = delete;
+
+    // Receives each piece of reply text as soon as its SSE event arrives (on the worker thread)
+    using ChunkCallback = std::function<void(const std::string&)>;
+
+    // Start a request without blocking; with onChunk set the reply is streamed (streamGenerateContent).
+    // onDone runs on the worker thread when the request finishes, before get() would block.
+    std::unique_ptr<PendingReply> start(std::string payload, ChunkCallback onChunk = nullptr,
+                                        std::function<void()> onDone = nullptr);
+
+    std::string sendMessage(const nlohmann::json& conversation);
+    // Calls streamGenerateContent (SSE) and returns the full reply text once the stream ends
+    std::string streamMessage(const nlohmann::json& conversation, const ChunkCallback& onChunk);
+    // Same as above for a request body that is already serialized (Conversation::toGeminiPayload)
+    std::string sendPayload(const std::string& payload);
+    std::string streamPayload(const std::string& payload, const ChunkCallback& onChunk);
     std::string extractGeminiReply(const std::string& responseStr) const;
+    // true with an API key, or in replay mode
     bool isConfigured() const;
 private:
+    friend class PendingReply;
+
     std::string apiKey;
-};
\ No newline at end of file
+    // GEMINI_BASE_URL / GEMINI_MODEL allow pointing the client at a local stand-in server
+    std::string baseUrl;
+    std::string model;
+    std::string url;
+    std::string streamUrl;
+    // GEMINI_CONNECT_TIMEOUT_MS / GEMINI_TIMEOUT_MS, 0 disables the deadline
+    long connectTimeoutMs = 0;
+    long timeoutMs = 0;
+
+    // GEMINI_RATE_LIMIT_RPM / GEMINI_RATE_LIMIT_BURST, GEMINI_MAX_RETRIES, GEMINI_RETRY_BASE_MS / GEMINI_RETRY_MAX_MS
+    TokenBucket bucket;
+    int maxRetries = 3;
+    std::chrono::milliseconds retryBase{1000};
+    std::chrono::milliseconds retryMax{60000};
+
+    // GEMINI_GZIP_LEVEL (0 sends plain JSON); cleared for good when the endpoint rejects a gzip body
+    int gzipLevel = 6;
+    std::atomic<bool> gzipRequests{false};
+
+    // GEMINI_TURN_DEADLINE_MS, 0 = none
+    long turnDeadlineMs = 0;
+    // GEMINI_HEDGE_PERCENTILE (0 disables hedging), GEMINI_HEDGE_MIN_MS
+    double hedgePercentile = 0;
+    std::chrono::milliseconds hedgeMinDelay{50};
+    // time from the start of an attempt to its first response byte over the last successful attempts,
+    // [0] generateContent, [1] streams; a ring, so the percentile follows the endpoint as it speeds up or slows down
+    struct FirstByteSamples
+    {
+        std::vector<double> ms;
+        size_t next = 0;
+    };
+    mutable std::mutex firstByteMutex;
+    FirstByteSamples firstByte[2];
+
+    // GEMINI_CACHE (off, on, replay), GEMINI_CACHE_DIR, GEMINI_CACHE_MAX_MB
+    std::unique_ptr<ResponseCache> cache;
+    bool replayOnly = false;
+
+    struct curl_slist* headers = nullptr;
+    struct curl_slist* gzipHeaders = nullptr;
+    std::unique_ptr<HttpEngine> engine = std::make_unique<HttpEngine>();
+
+    // Submit one attempt of the request, no earlier than delay from now and the next rate limit slot,
+    // together with its hedge when hedging is on
+    void submitAttempt(const std::shared_ptr<ReplyState>& state, std::chrono::milliseconds delay);
+    // Build the transfer for one attempt (or its hedge); serial identifies it in the callbacks
+    HttpRequest makeRequest(const std::shared_ptr<ReplyState>& state, const std::shared_ptr<StreamState>& stream,
+                            unsigned serial, std::chrono::steady_clock::time_point notBefore);
+    // Worker thread: retry the attempt that just finished or complete the reply
+    void attemptFinished(const std::shared_ptr<ReplyState>& state, unsigned serial);
+    // How long an attempt waits for its first byte before it is hedged; negative while hedging is off
+    // or there are too few samples to take the percentile from
+    std::chrono::milliseconds hedgeDelay(bool stream) const;
+    // Backoff before retrying, or a negative value when the result should not be retried
+    std::chrono::milliseconds retryDelay(const ReplyState& state, const HttpResult& result);
+    // Keep a successful reply for the next identical request
+    void cacheReply(const ReplyState& state, const std::string& text) const;
+};
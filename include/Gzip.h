@@ -0,0 +1,18 @@
+/*
+Gzip.h - gzip encoding of request bodies
+The request body carries the whole history on every turn and JSON text compresses several times over,
+so large bodies are sent with Content-Encoding: gzip. Needs zlib (HAVE_ZLIB); without it bodies go out as is.
+Decoding is only needed by the local mock server (tools/mock_gemini.cpp), which has to read what the client sends.
+*/
+#pragma once
+
+#include <string>
+
+// True if zlib was compiled in
+bool gzipAvailable();
+
+// gzip-encode raw into out at the given zlib level (1-9); returns false if zlib is missing or fails
+bool gzipCompress(const std::string &raw, std::string &out, int level);
+
+// Decode a gzip stream into out; returns false if zlib is missing or the input is not valid gzip
+bool gzipDecompress(const std::string &compressed, std::string &out);
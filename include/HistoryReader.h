@@ -0,0 +1,34 @@
+/*
+HistoryReader.h - Streaming loader for conversation history files
+The JSON history is parsed with a SAX handler that fills Message objects directly, so loading
+never materializes a JSON DOM or an intermediate copy of the messages.
+*/
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "Conversation.h"
+
+// Everything a history file carries besides the messages themselves
+struct LoadedHistory
+{
+    std::vector<Message> messages;
+    // owns the message contents until the Conversation adopts it
+    StringArena arena;
+    std::string summary;
+    size_t summaryCovers = 0;
+    uint64_t generation = 0;
+    // index of messages[0] in the file (a binary session can be read in part)
+    size_t first = 0;
+};
+
+// Message timestamps are written as "YYYY-MM-DD HH:MM:SS"; epoch seconds are accepted too.
+// Text in any other format loads as 0 rather than rejecting the file.
+int64_t timestampFromText(std::string_view text);
+int64_t timestampFromJson(const nlohmann::json &value);
+
+// Parse a history document ({"messages": [{role, content, timestamp}, ...]}) from memory.
+// Applies the same validation rules as Conversation::fromJson and throws the same exception types.
+void parseHistoryJson(const char *begin, const char *end, LoadedHistory &out);
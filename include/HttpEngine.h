@@ -0,0 +1,134 @@
+/*
+HttpEngine.h - Background HTTP worker built on curl's multi interface
+Requests are submitted from any thread and driven by one worker thread that owns a curl multi
+handle. Easy handles are pooled and reset between requests, so connections, DNS entries and TLS
+sessions stay warm across requests. Every transfer can be cancelled while it is in flight.
+*/
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <curl/curl.h>
+
+struct HttpRequest
+{
+    std::string url;
+    std::string body;
+    // owned by the caller, must outlive the transfer
+    const struct curl_slist *headers = nullptr;
+    // receives the response body as it arrives; return false to abort the transfer.
+    // When empty the body is collected in HttpResult::body. Runs on the worker thread.
+    std::function<bool(const char *data, size_t size)> onData;
+    // called on the worker thread once the result is published (lets a caller wait for any of many transfers)
+    std::function<void()> onComplete;
+    // called on the worker thread when the first byte of the response body arrives, before it is delivered
+    std::function<void()> onFirstByte;
+    long connectTimeoutMs = 0;
+    long timeoutMs = 0;
+    // the worker holds the request back until then (rate limiting, retry backoff)
+    std::chrono::steady_clock::time_point notBefore;
+    // open a connection of its own instead of sharing a pooled or multiplexed one
+    bool freshConnection = false;
+};
+
+// Phase timestamps reported by curl, in microseconds since the transfer started (0 = phase not reached)
+struct HttpTimings
+{
+    curl_off_t nameLookup = 0;
+    curl_off_t connect = 0;
+    curl_off_t appConnect = 0;
+    curl_off_t preTransfer = 0;
+    curl_off_t startTransfer = 0;
+    curl_off_t total = 0;
+    // connections opened for this transfer (0 when a pooled one was reused)
+    long newConnections = 0;
+    // as sent and received on the wire: bytesDownloaded is before content decoding
+    curl_off_t bytesUploaded = 0;
+    curl_off_t bytesDownloaded = 0;
+};
+
+struct HttpResult
+{
+    CURLcode code = CURLE_OK;
+    long status = 0;
+    bool cancelled = false;
+    std::string body;
+    HttpTimings timings;
+};
+
+// Handle for one submitted request, shared between the caller and the worker
+class HttpTransfer
+{
+public:
+    void cancel();
+    bool cancelRequested() const;
+    bool done() const;
+    // Wait up to timeout for completion; returns done()
+    bool waitFor(std::chrono::milliseconds timeout) const;
+    void wait() const;
+    // Valid once done() is true
+    const HttpResult &result() const;
+    // Move the collected body out once done(); result().body is empty afterwards
+    std::string takeBody();
+    size_t bytesReceived() const;
+
+    // Called on the worker thread for each piece of the response body
+    bool deliver(const char *data, size_t size);
+    // Called on the worker thread with the announced Content-Length: size the body buffer once
+    void expectBody(size_t size);
+
+private:
+    friend class HttpEngine;
+
+    HttpRequest request;
+    HttpResult outcome;
+    std::function<void()> wakeWorker;
+    std::atomic<bool> cancelFlag{false};
+    std::atomic<size_t> received{0};
+    mutable std::mutex mutex;
+    mutable std::condition_variable finished;
+    bool complete = false;
+};
+
+class HttpEngine
+{
+public:
+    HttpEngine();
+    ~HttpEngine();
+    HttpEngine(const HttpEngine &) = delete;
+    HttpEngine &operator=(const HttpEngine &) = delete;
+
+    std::shared_ptr<HttpTransfer> submit(HttpRequest request);
+
+private:
+    CURLM *multi = nullptr;
+    std::thread worker;
+    std::mutex queueMutex;
+    std::deque<std::shared_ptr<HttpTransfer>> queue;
+    bool stopping = false;
+
+    // worker-thread state
+    struct Active
+    {
+        CURL *easy;
+        std::shared_ptr<HttpTransfer> transfer;
+    };
+    std::vector<Active> active;
+    std::vector<CURL *> idleHandles;
+    // submitted with a notBefore still in the future
+    std::vector<std::shared_ptr<HttpTransfer>> delayed;
+
+    void run();
+    void start(const std::shared_ptr<HttpTransfer> &transfer);
+    void finish(size_t index, CURLcode code, bool cancelled);
+    void drop(const std::shared_ptr<HttpTransfer> &transfer);
+    void wake();
+};
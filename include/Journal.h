@@ -0,0 +1,44 @@
+/*
+Journal.h - Header file for the Journal class
+The journal is an append-only log written next to the conversation snapshot (<file>.journal).
+Every message is appended as one JSON line, so persisting a turn only costs the new messages.
+On startup the journal is replayed on top of the snapshot, and it is periodically folded back
+into the snapshot (compaction) by the Conversation.
+*/
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Message;
+class StringArena;
+
+class Journal
+{
+private:
+    std::string path;
+    size_t recordCount = 0;
+
+public:
+    Journal() = default;
+    explicit Journal(std::string path);
+
+    const std::string &getPath() const;
+    size_t records() const;
+
+    // Replay the records written for the given snapshot generation on top of messages.
+    // Recovered contents are stored in arena. Returns true if the journal exists and belongs to
+    // that generation (safe to append to). messages[i] is message first + i (a snapshot opened lazily).
+    bool replay(uint64_t generation, std::vector<Message> &messages, StringArena &arena, size_t first = 0);
+
+    // Records for messages from index from on, one line per message; messages[i] is message first + i
+    static std::string encode(const std::vector<Message> &messages, size_t from, size_t first = 0);
+    // Append encoded records to the journal at path with one fsync. Only the file is touched, so the
+    // writer thread calls it without holding the conversation's lock.
+    static bool appendRecords(const std::string &path, const std::string &records);
+    // Truncate the journal at path and start a new generation
+    static bool create(const std::string &path, uint64_t generation);
+    // Count records appended to this journal with appendRecords
+    void recorded(size_t count);
+};
@@ -0,0 +1,30 @@
+/*
+MappedFile.h - Read-only memory mapping of a file
+Lets loaders parse straight from the page cache instead of copying the file into a stream buffer.
+*/
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+class MappedFile
+{
+private:
+    const char *ptr = nullptr;
+    size_t length = 0;
+
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Map the whole file; on failure returns false and describes the problem in error
+    bool open(const std::string &FILENAME, std::string &error);
+    void close();
+
+    const char *data() const;
+    size_t size() const;
+};
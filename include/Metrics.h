@@ -0,0 +1,83 @@
+/*
+Metrics.h - In-process metrics registry
+Named latency histograms (milliseconds, fixed buckets) and counters. The client, the CLI loop and the
+persistence code record into one process-wide registry, which /stats prints and which can be written as
+JSON (GEMINI_METRICS_FILE) for monitoring to scrape.
+*/
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+class Histogram
+{
+private:
+    // one counter per bucket in bounds(), plus the overflow bucket
+    std::vector<uint64_t> buckets;
+    uint64_t samples = 0;
+    double sum = 0;
+    double min = 0;
+    double max = 0;
+
+public:
+    // Upper bucket bounds in milliseconds (0.1 ms .. 5 min)
+    static const std::vector<double> &bounds();
+
+    Histogram();
+    void record(double ms);
+    uint64_t count() const;
+    double mean() const;
+    // Estimated from the buckets (linear within a bucket), q in [0, 1]
+    double percentile(double q) const;
+    nlohmann::json toJson() const;
+};
+
+class MetricsRegistry
+{
+private:
+    mutable std::mutex mutex;
+    std::map<std::string, Histogram> histograms;
+    std::map<std::string, uint64_t> counters;
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+public:
+    void record(const std::string &name, double ms);
+    void increment(const std::string &name, uint64_t by = 1);
+
+    // Table of histograms (count, mean, p50/p90/p99, max) and counters, for /stats
+    std::string report() const;
+    nlohmann::json toJson() const;
+    // Replace the file atomically (temporary file + rename) so a scraper never reads half a dump
+    bool writeToFile(const std::string &FILENAME) const;
+};
+
+// Process-wide registry
+MetricsRegistry &metrics();
+
+// Records the time between construction and stop() (or destruction) into a histogram
+class ScopedTimer
+{
+private:
+    std::string name;
+    std::chrono::steady_clock::time_point begin;
+    bool stopped = false;
+
+public:
+    explicit ScopedTimer(std::string name);
+    ~ScopedTimer();
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+    // Record now instead of at destruction; returns the elapsed milliseconds
+    double stop();
+};
+
+inline double elapsedMs(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
@@ -0,0 +1,50 @@
+/*
+PersistenceWorker.h - Background writer for session state
+A turn only marks its session dirty; one writer thread does the journal appends, snapshot rewrites and fsyncs,
+so the cost of durability stays off the turn's latency. Sessions marked again while a write is running are
+coalesced: the next pass writes everything that accumulated in one append and one fsync (group commit).
+Failures are queued for the main thread to report, since the writer has no terminal of its own.
+*/
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class PersistenceWorker
+{
+public:
+    // Writes one session; on failure returns false with a message in error
+    using SaveFunction = std::function<bool(const std::string &key, std::string &error)>;
+
+    explicit PersistenceWorker(SaveFunction save);
+    // Writes whatever is still pending before the thread exits
+    ~PersistenceWorker();
+
+    PersistenceWorker(const PersistenceWorker &) = delete;
+    PersistenceWorker &operator=(const PersistenceWorker &) = delete;
+
+    // Queue key for writing; returns immediately
+    void markDirty(const std::string &key);
+    // Block until every key marked so far has been written or has failed
+    void flush();
+    // Failures since the last call, oldest first
+    std::vector<std::string> takeErrors();
+
+private:
+    SaveFunction save;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    // keys waiting for the next pass, each at most once
+    std::vector<std::string> dirty;
+    std::vector<std::string> errors;
+    bool writing = false;
+    bool stopping = false;
+    std::thread thread;
+
+    void run();
+};
@@ -0,0 +1,34 @@
+/*
+RateLimiter.h - Client-side request pacing and retry backoff
+TokenBucket hands out start times instead of blocking the caller: every request reserves the next token, so
+queued requests are spaced at the configured rate in FIFO order, up to `capacity` may start back to back, and a
+pause requested by the server (retryDelay) delays everything queued behind it.
+*/
+#pragma once
+
+#include <chrono>
+#include <mutex>
+
+class TokenBucket
+{
+private:
+    std::mutex mutex;
+    // seconds per token; 0 disables limiting
+    double interval = 0;
+    double capacity = 1;
+    // theoretical arrival time of the next request (GCRA)
+    std::chrono::steady_clock::time_point nextFree;
+    std::chrono::steady_clock::time_point pausedUntil;
+
+public:
+    // rate in requests per second (0 = unlimited), capacity = requests allowed back to back
+    void configure(double rate, double capacity);
+
+    // Earliest time at which the caller may start its request (now if a token is free)
+    std::chrono::steady_clock::time_point reserve();
+    // No reservation starts before `until`
+    void pauseUntil(std::chrono::steady_clock::time_point until);
+};
+
+// Jittered exponential backoff: uniform in [base, min(cap, base * 2^attempt)]
+std::chrono::milliseconds backoffDelay(int attempt, std::chrono::milliseconds base, std::chrono::milliseconds cap);
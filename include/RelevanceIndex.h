@@ -0,0 +1,60 @@
+/*
+RelevanceIndex.h - Full-text index over the messages of a conversation
+An inverted index from lower-cased terms to positional postings, ranked with BM25. Messages are added in order
+and never removed, so indexing a turn only touches the new messages; a query walks the postings of its own
+terms. Terms are runs of ASCII letters and digits (or of non-ASCII UTF-8 bytes); very common English words
+and single characters are skipped and do not take a position.
+
+Postings are varint encoded per term: for every document containing it, the document delta, the term
+frequency and the position deltas. The index is saved next to a session snapshot (<file>.index) under the
+snapshot's generation, so opening a session only indexes the messages replayed from its journal.
+*/
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class RelevanceIndex
+{
+private:
+    struct Term
+    {
+        std::string postings;
+        uint32_t documents = 0;
+        uint32_t lastDoc = 0;
+    };
+
+    std::unordered_map<std::string, uint32_t> termIds;
+    std::vector<Term> terms;
+    // indexed terms per document
+    std::vector<uint32_t> lengths;
+    uint64_t totalLength = 0;
+
+    // BM25 over documents [0, limit), optionally restricted to the sorted documents in only
+    std::vector<std::pair<size_t, double>> rank(const std::vector<uint32_t> &queryTerms, size_t k, size_t limit,
+                                                const std::vector<uint32_t> *only) const;
+    // Sorted documents in which the terms appear at consecutive positions
+    std::vector<uint32_t> phraseDocuments(const std::vector<uint32_t> &phraseTerms) const;
+
+public:
+    // Index text as the next document; its id is size() before the call
+    void add(std::string_view text);
+    void clear();
+    size_t size() const;
+
+    // Documents [0, limit) ranked by BM25 against query, best first; at most k, only documents sharing a term
+    std::vector<std::pair<size_t, double>> search(std::string_view query, size_t k, size_t limit) const;
+    // Same ranking for an interactive query: "quoted phrases" must appear word for word in a hit
+    std::vector<std::pair<size_t, double>> find(std::string_view query, size_t k) const;
+
+    // Write the index atomically (temporary file, fsync, rename) tagged with a snapshot generation
+    bool save(const std::string &FILENAME, uint64_t generation) const;
+    // The bytes save() writes
+    std::string serialize(uint64_t generation) const;
+    // Load an index written for this generation and exactly documents documents; false (and empty) otherwise
+    bool load(const std::string &FILENAME, uint64_t generation, size_t documents);
+};
@@ -0,0 +1,50 @@
+/*
+ResponseCache.h - On-disk cache of model replies keyed by the exact request
+Each entry is one file, <sha256>.reply, holding the reply text for a request body sent to a model; the key
+is the SHA-256 of the model name and the body, so any change to the history, the context selection or the
+model is a different entry. Entries are written through a temporary file and a rename. The directory is
+bounded in bytes: the least recently used entries are deleted first, and a hit refreshes the file's
+modification time so the order survives restarts.
+*/
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+class ResponseCache
+{
+private:
+    std::filesystem::path dir;
+    uint64_t maxBytes;
+    uint64_t totalBytes = 0;
+
+    // most recently used first
+    std::list<std::string> lru;
+    std::unordered_map<std::string, std::pair<uint64_t, std::list<std::string>::iterator>> entries;
+    // lookups run on the caller's thread, stores wherever a reply completes
+    mutable std::mutex mutex;
+
+    std::filesystem::path pathOf(const std::string &key) const;
+    // Delete least recently used entries until the cache fits maxBytes (mutex held)
+    void evict();
+
+public:
+    ResponseCache(std::filesystem::path dir, uint64_t maxBytes);
+
+    // Create the directory and index the entries already in it, oldest last
+    bool open(std::string &error);
+
+    static std::string key(std::string_view model, std::string_view payload);
+
+    bool lookup(const std::string &key, std::string &reply);
+    bool store(const std::string &key, const std::string &reply);
+
+    size_t size() const;
+    uint64_t bytes() const;
+};
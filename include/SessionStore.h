@@ -0,0 +1,143 @@
+/*
+SessionStore.h - Named conversation sessions under the data directory
+Every session is a snapshot + journal pair: data/sessions/<id>.json, with the original data/chat_history.json
+kept as the "default" session. data/sessions/index.json lists all sessions with their title, message count,
+last modification and the snapshot/journal sizes at that time, so listing sessions never opens a session file.
+Loaded conversations stay in an LRU cache: switching to a resident session is a hash lookup, and only a miss
+reads a snapshot and replays its journal.
+Sessions stored as binary (.gcs) snapshots open with only their newest messages decoded; the older ones are
+read through the snapshot's block index when first needed (see Conversation::faultIn).
+The daemon's clients each work in their own session and reach it by id (session(), markDirty(id)); the
+store's current session is only the one the interactive commands act on. Switching it writes nothing: the
+last used session is recorded in the index by the next save, or by flush() at exit.
+Saving after a turn is asynchronous (see PersistenceWorker.h): the writer thread reads resident conversations
+while the main thread keeps using them, so the main thread holds lock() whenever it changes one. The writer
+only holds it to copy out what it is about to write; the appends, snapshot rewrites and fsyncs run without it.
+*/
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "Conversation.h"
+#include "PersistenceWorker.h"
+
+struct SessionInfo
+{
+    std::string id;
+    std::string title;
+    // snapshot path relative to the data directory (the journal is <file>.journal)
+    std::string file;
+    size_t messages = 0;
+    int64_t modified = 0;
+    // file sizes when the entry was written; differing sizes mean the entry predates the last write
+    uint64_t snapshotBytes = 0;
+    uint64_t journalBytes = 0;
+};
+
+class SessionStore
+{
+private:
+    std::filesystem::path dataDir;
+    size_t residentLimit;
+    std::unordered_map<std::string, SessionInfo> sessions;
+    std::string currentId;
+    uint64_t nextId = 1;
+    // snapshot format of sessions created from now on: ".json" or BINARY_SESSION_EXTENSION
+    std::string sessionExtension = ".json";
+    size_t tailMessages = 1000;
+    size_t sessionMemoryLimit = 0;
+
+    // most recently used first
+    std::list<std::string> lru;
+    std::unordered_map<std::string, std::pair<std::unique_ptr<Conversation>, std::list<std::string>::iterator>> resident;
+
+    // guards everything above; shared with the writer thread
+    mutable std::mutex mutex;
+
+    // session whose files the writer thread is writing without the mutex; evicting it waits
+    std::string saving;
+    std::condition_variable_any writeDone;
+    // Wait until the writer is done with id's files (mutex held)
+    void awaitWrite(const std::string &id);
+
+    // contents of the index are numbered under the mutex and written under indexMutex, newest only, and
+    // only when they differ from what the file already holds
+    uint64_t indexVersion = 0;
+    std::mutex indexMutex;
+    uint64_t indexVersionWritten = 0;
+    std::string indexWritten;
+
+    std::filesystem::path indexPath() const;
+    std::string pathOf(const SessionInfo &info) const;
+    bool readIndex();
+    // index.json as it should read now (mutex held)
+    std::string indexContents() const;
+    bool storeIndex(const std::string &contents, uint64_t version);
+    bool writeIndex();
+    // Conversation for id from the cache or from disk; evicts the least recently used beyond the limit.
+    // On failure corrupt is set when the files are damaged rather than unreadable for now.
+    Conversation *load(const std::string &id, bool &corrupt);
+    // load(), throwing if the session cannot be read; its files are left as they are (mutex held)
+    Conversation &require(const std::string &id);
+    // Resident empty conversation for a session whose files are damaged (they are moved aside)
+    Conversation &startEmpty(const std::string &id);
+    Conversation *makeResident(const std::string &id, std::unique_ptr<Conversation> convo);
+    // Refresh message count, sizes and (if unset) the title from the conversation
+    void refresh(SessionInfo &info, const Conversation &convo);
+    std::string newId();
+    // Writer thread: append (or compact) without the mutex, fall back to a full snapshot, then to an emergency backup
+    bool saveSession(const std::string &id, std::string &error);
+
+    // declared last: destroyed first, draining its queue while the sessions still exist
+    PersistenceWorker writer;
+
+public:
+    explicit SessionStore(std::filesystem::path dataDir, size_t residentLimit = 16);
+
+    // Write new sessions (/new, /load) as binary snapshots instead of JSON
+    void setBinarySessions(bool binary);
+    // Messages decoded when a binary session is opened (see Conversation::setTailMessages)
+    void setTailMessages(size_t count);
+    // Message text each loaded session keeps in memory before spilling to ./data (see Conversation::setMemoryLimit)
+    void setSessionMemoryLimit(size_t bytes);
+
+    // Read the index (building it on first use) and load the last used session
+    bool open();
+
+    // Both throw std::runtime_error if the session's files cannot be read
+    Conversation &current();
+    SessionInfo currentInfo() const;
+    // Session id's conversation, loaded if it is not resident; the current session stays as it is
+    Conversation &session(const std::string &id);
+    std::string currentPath() const;
+
+    // Hold while changing a resident conversation (adding messages, clearing, setting the summary)
+    std::unique_lock<std::mutex> lock() const;
+
+    // All sessions, most recently modified first
+    std::vector<SessionInfo> list() const;
+    bool isResident(const std::string &id) const;
+
+    // Switch by id or by a title prefix that matches a single session; throws if it cannot be read
+    bool switchTo(const std::string &key);
+    // Create an empty session and make it current
+    SessionInfo create(const std::string &title);
+    // Copy a JSON or binary history file into a new session and make it current
+    bool import(const std::string &FILENAME);
+
+    // Queue the current session (or session id) for the writer thread; returns immediately
+    void markDirty();
+    void markDirty(const std::string &id);
+    // Wait until every queued save has been written and the index is up to date (at exit)
+    void flush();
+    // Save failures reported by the writer since the last call
+    std::vector<std::string> takeSaveErrors();
+};
@@ -0,0 +1,28 @@
+/*
+Sha256.h - SHA-256 digest (FIPS 180-4)
+Small self-contained implementation used to key cached responses by their exact request; it is not meant
+for anything security sensitive.
+*/
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+class Sha256
+{
+private:
+    std::array<uint32_t, 8> state;
+    std::array<unsigned char, 64> block;
+    size_t blockSize = 0;
+    uint64_t totalBytes = 0;
+
+    void compress(const unsigned char *chunk);
+
+public:
+    Sha256();
+    void update(std::string_view data);
+    // Finish the digest as 64 lower-case hex characters; the object must not be updated afterwards
+    std::string hexDigest();
+};
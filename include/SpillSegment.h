@@ -0,0 +1,38 @@
+/*
+SpillSegment.h - Scratch file holding message text evicted from memory
+Conversation moves the bodies (and cached request entries) of its oldest messages here once the text it
+holds exceeds its memory limit. Every append is mapped read-only on its own, so the views handed out for
+earlier appends stay valid while the file grows; reading them back is left to the page cache, which can
+drop the pages again under memory pressure. The file is unlinked as soon as it is created, so nothing is
+left behind after a crash.
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+class SpillSegment
+{
+private:
+    int fd = -1;
+    uint64_t length = 0;
+    std::vector<std::pair<void *, size_t>> mappings;
+
+public:
+    SpillSegment() = default;
+    ~SpillSegment();
+    SpillSegment(const SpillSegment &) = delete;
+    SpillSegment &operator=(const SpillSegment &) = delete;
+
+    // Create the (already unlinked) scratch file in dir
+    bool open(const std::string &dir, std::string &error);
+    // Write data at the end of the file and map it; the returned bytes stay readable until destruction.
+    // nullptr on failure, with the reason in error.
+    const char *append(const std::string &data, std::string &error);
+
+    // Bytes written so far
+    uint64_t bytes() const;
+};
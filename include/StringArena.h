@@ -0,0 +1,44 @@
+/*
+StringArena.h - Chunked, append-only string storage
+Message contents are copied into large chunks owned by the Conversation instead of one heap
+allocation per message. Returned views stay valid until clear() or destruction (moving the arena
+keeps them valid, the chunks themselves never move).
+*/
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+class StringArena
+{
+private:
+    struct Chunk
+    {
+        std::unique_ptr<char[]> data;
+        size_t capacity = 0;
+        size_t used = 0;
+    };
+
+    std::vector<Chunk> chunks;
+    size_t chunkSize;
+    size_t bytesUsed = 0;
+    size_t bytesReserved = 0;
+
+public:
+    explicit StringArena(size_t chunkSize = 64 * 1024);
+    StringArena(StringArena &&) noexcept = default;
+    StringArena &operator=(StringArena &&) noexcept = default;
+    StringArena(const StringArena &) = delete;
+    StringArena &operator=(const StringArena &) = delete;
+
+    // Copy text into the arena; strings larger than a chunk get a chunk of their own
+    std::string_view store(std::string_view text);
+    // Take over the chunks of other; views into them stay valid
+    void adopt(StringArena &&other);
+    void clear();
+
+    size_t used() const;
+    size_t reserved() const;
+};
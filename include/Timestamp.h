@@ -0,0 +1,18 @@
+/*
+Timestamp.h - Message timestamps
+Messages keep seconds since the Unix epoch; the "YYYY-MM-DD HH:MM:SS" local time text is only
+produced when a message is displayed or exported.
+*/
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+int64_t currentEpochSeconds();
+
+// Format as "YYYY-MM-DD HH:MM:SS" in local time
+std::string formatTimestamp(int64_t epochSeconds);
+
+// Parse "YYYY-MM-DD HH:MM:SS" (local time); returns false if the text is not in that format
+bool parseTimestamp(std::string_view text, int64_t &epochSeconds);
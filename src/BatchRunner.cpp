@@ -0,0 +1,225 @@
+#include "BatchRunner.h"
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "Metrics.h"
+
+struct BatchPrompt
+{
+    std::string id;
+    std::string prompt;
+};
+
+struct BatchConversation
+{
+    std::string name;
+    Conversation convo;
+    std::vector<BatchPrompt> prompts;
+    size_t next = 0;
+    std::unique_ptr<PendingReply> pending;
+};
+
+// Group the input lines into conversations, keeping the order in which conversations first appear
+static bool readPrompts(const std::string &FILENAME, std::vector<BatchConversation> &conversations, size_t &invalid)
+{
+    std::ifstream file(FILENAME);
+    if (!file)
+    {
+        std::cerr << "Error: cannot open batch input " << FILENAME << "\n";
+        return false;
+    }
+
+    std::map<std::string, size_t> byName;
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(file, line))
+    {
+        ++lineNumber;
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+
+        nlohmann::json entry = nlohmann::json::parse(line, nullptr, false);
+        if (entry.is_discarded() || !entry.is_object() || !entry.contains("prompt") || !entry["prompt"].is_string())
+        {
+            std::cerr << "Warning: skipping line " << lineNumber << " of " << FILENAME << ": expected {\"prompt\": \"...\"}\n";
+            ++invalid;
+            continue;
+        }
+
+        BatchPrompt prompt;
+        prompt.prompt = entry["prompt"].get<std::string>();
+        if (entry.contains("id"))
+            prompt.id = entry["id"].is_string() ? entry["id"].get<std::string>() : entry["id"].dump();
+        else
+            prompt.id = std::to_string(lineNumber);
+
+        std::string name;
+        if (entry.contains("conversation"))
+            name = entry["conversation"].is_string() ? entry["conversation"].get<std::string>() : entry["conversation"].dump();
+
+        // a prompt without a conversation stands alone
+        size_t index = conversations.size();
+        if (name.empty())
+        {
+            conversations.emplace_back();
+        }
+        else
+        {
+            auto [it, added] = byName.emplace(name, index);
+            if (added)
+            {
+                conversations.emplace_back();
+                conversations.back().name = name;
+            }
+            index = it->second;
+        }
+        conversations[index].prompts.push_back(std::move(prompt));
+    }
+    return true;
+}
+
+static void writeResult(std::ostream &out, const BatchConversation &conv, size_t turn,
+                        const std::string *reply, const std::string *error)
+{
+    nlohmann::json result;
+    result["id"] = conv.prompts[turn].id;
+    if (!conv.name.empty())
+        result["conversation"] = conv.name;
+    result["turn"] = turn;
+    if (reply)
+        result["reply"] = *reply;
+    else
+        result["error"] = *error;
+    // replies are not guaranteed to be valid UTF-8; never let one line abort the batch
+    out << result.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace) << "\n";
+    out.flush();
+}
+
+int runBatch(GeminiClient &client, const BatchOptions &options)
+{
+    std::vector<BatchConversation> conversations;
+    size_t invalid = 0;
+    if (!readPrompts(options.inputFile, conversations, invalid))
+        return -1;
+
+    std::ofstream outFile;
+    if (!options.outputFile.empty() && options.outputFile != "-")
+    {
+        outFile.open(options.outputFile, std::ios::trunc);
+        if (!outFile)
+        {
+            std::cerr << "Error: cannot write batch output " << options.outputFile << "\n";
+            return -1;
+        }
+    }
+    std::ostream &out = outFile.is_open() ? outFile : std::cout;
+
+    size_t total = 0;
+    for (const BatchConversation &conv : conversations)
+        total += conv.prompts.size();
+    const size_t concurrency = options.concurrency ? options.concurrency : 1;
+    std::cerr << "Batch: " << total << " prompt(s) in " << conversations.size() << " conversation(s), concurrency "
+              << concurrency << "\n";
+
+    // finished transfers are reported by the worker thread
+    std::mutex finishedMutex;
+    std::condition_variable finishedSignal;
+    std::vector<size_t> finished;
+
+    std::deque<size_t> ready;
+    for (size_t i = 0; i < conversations.size(); ++i)
+        ready.push_back(i);
+
+    size_t inFlight = 0;
+    size_t completed = 0;
+    size_t failed = invalid;
+    const auto started = std::chrono::steady_clock::now();
+
+    // the reply to one turn (or its failure) was written; queue the conversation's next prompt
+    auto advance = [&](size_t index)
+    {
+        BatchConversation &conv = conversations[index];
+        conv.pending.reset();
+        ++conv.next;
+        ++completed;
+        if (conv.next < conv.prompts.size())
+            ready.push_back(index);
+        if (completed % 100 == 0 || completed == total)
+        {
+            double seconds = elapsedMs(started) / 1000.0;
+            std::cerr << "Batch: " << completed << "/" << total << " done, " << failed << " failed, "
+                      << (seconds > 0 ? completed / seconds : 0) << " prompts/s\n";
+        }
+    };
+
+    while (completed < total)
+    {
+        while (inFlight < concurrency && !ready.empty())
+        {
+            size_t index = ready.front();
+            ready.pop_front();
+            BatchConversation &conv = conversations[index];
+            try
+            {
+                conv.convo.addMessage(Role::user, conv.prompts[conv.next].prompt);
+                std::string payload = options.policy
+                                          ? conv.convo.toGeminiPayload(options.policy->select(conv.convo, options.contextBudget))
+                                          : conv.convo.toGeminiPayload();
+                conv.pending = client.start(std::move(payload), nullptr, [&, index]()
+                                            {
+                    std::lock_guard<std::mutex> lock(finishedMutex);
+                    finished.push_back(index);
+                    finishedSignal.notify_one(); });
+                ++inFlight;
+            }
+            catch (const std::exception &e)
+            {
+                std::string error = e.what();
+                writeResult(out, conv, conv.next, nullptr, &error);
+                ++failed;
+                advance(index);
+            }
+        }
+
+        if (inFlight == 0)
+            continue;
+
+        std::vector<size_t> done;
+        {
+            std::unique_lock<std::mutex> lock(finishedMutex);
+            finishedSignal.wait(lock, [&] { return !finished.empty(); });
+            done.swap(finished);
+        }
+
+        for (size_t index : done)
+        {
+            --inFlight;
+            BatchConversation &conv = conversations[index];
+            try
+            {
+                std::string reply = conv.pending->get();
+                conv.convo.addMessage(Role::model, reply);
+                writeResult(out, conv, conv.next, &reply, nullptr);
+            }
+            catch (const std::exception &e)
+            {
+                std::string error = e.what();
+                writeResult(out, conv, conv.next, nullptr, &error);
+                ++failed;
+            }
+            advance(index);
+        }
+    }
+
+    metrics().increment("batch.prompts", total);
+    metrics().increment("batch.failed", failed);
+    std::cerr << "Batch finished: " << total << " prompt(s), " << failed << " failed, "
+              << elapsedMs(started) / 1000.0 << " s\n";
+    return static_cast<int>(failed);
+}
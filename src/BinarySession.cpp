@@ -0,0 +1,413 @@
+#include "BinarySession.h"
+#include "HistoryReader.h"
+#include "Timestamp.h"
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+const char *const BINARY_SESSION_EXTENSION = ".gcs";
+
+static const char MAGIC[4] = {'G', 'C', 'S', 'B'};
+// version 1 stored the formatted timestamp text, version 2 stores epoch seconds
+static const uint16_t FORMAT_VERSION = 2;
+static const size_t HEADER_SIZE = 48;
+static const size_t INDEX_ENTRY_SIZE = 32;
+static const size_t BLOCK_TARGET_SIZE = 256 * 1024;
+
+// little-endian encoding helpers
+static void putU16(std::string &out, uint16_t v)
+{
+    for (int i = 0; i < 2; ++i)
+        out += static_cast<char>((v >> (8 * i)) & 0xFF);
+}
+
+static void putU32(std::string &out, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i)
+        out += static_cast<char>((v >> (8 * i)) & 0xFF);
+}
+
+static void putU64(std::string &out, uint64_t v)
+{
+    for (int i = 0; i < 8; ++i)
+        out += static_cast<char>((v >> (8 * i)) & 0xFF);
+}
+
+static uint64_t getLE(const char *p, int bytes)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; ++i)
+        v |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+    return v;
+}
+
+[[noreturn]] static void corrupt(const std::string &what)
+{
+    throw std::runtime_error("Corrupt session file: " + what);
+}
+
+bool compressionAvailable(Compression codec)
+{
+    switch (codec)
+    {
+    case Compression::none:
+        return true;
+    case Compression::zstd:
+#ifdef HAVE_ZSTD
+        return true;
+#else
+        return false;
+#endif
+    case Compression::lz4:
+#ifdef HAVE_LZ4
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+Compression defaultCompression()
+{
+    if (compressionAvailable(Compression::zstd))
+        return Compression::zstd;
+    if (compressionAvailable(Compression::lz4))
+        return Compression::lz4;
+    return Compression::none;
+}
+
+Compression parseCompression(const std::string &name)
+{
+    if (name == "none")
+        return Compression::none;
+    if (name == "zstd")
+        return Compression::zstd;
+    if (name == "lz4")
+        return Compression::lz4;
+    throw std::invalid_argument("Unknown compression '" + name + "' (expected none, zstd or lz4)");
+}
+
+bool isBinarySession(const char *data, size_t size)
+{
+    return size >= sizeof(MAGIC) && std::memcmp(data, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+// Compress a block; returns false (store raw) when the codec does not shrink it
+static bool compressBlock(Compression codec, const std::string &raw, std::string &out)
+{
+    switch (codec)
+    {
+    case Compression::none:
+        return false;
+    case Compression::zstd:
+    {
+#ifdef HAVE_ZSTD
+        out.resize(ZSTD_compressBound(raw.size()));
+        size_t n = ZSTD_compress(out.data(), out.size(), raw.data(), raw.size(), 3);
+        if (ZSTD_isError(n))
+            throw std::runtime_error(std::string("zstd compression failed: ") + ZSTD_getErrorName(n));
+        out.resize(n);
+        return out.size() < raw.size();
+#else
+        return false;
+#endif
+    }
+    case Compression::lz4:
+    {
+#ifdef HAVE_LZ4
+        out.resize(static_cast<size_t>(LZ4_compressBound(static_cast<int>(raw.size()))));
+        int n = LZ4_compress_default(raw.data(), out.data(), static_cast<int>(raw.size()), static_cast<int>(out.size()));
+        if (n <= 0)
+            throw std::runtime_error("LZ4 compression failed");
+        out.resize(static_cast<size_t>(n));
+        return out.size() < raw.size();
+#else
+        return false;
+#endif
+    }
+    }
+    return false;
+}
+
+static void decompressBlock(Compression codec, const char *src, size_t storedSize, std::string &raw)
+{
+    switch (codec)
+    {
+    case Compression::none:
+        if (storedSize != raw.size())
+            corrupt("block size mismatch");
+        std::memcpy(raw.data(), src, storedSize);
+        return;
+    case Compression::zstd:
+    {
+#ifdef HAVE_ZSTD
+        size_t n = ZSTD_decompress(raw.data(), raw.size(), src, storedSize);
+        if (ZSTD_isError(n) || n != raw.size())
+            corrupt("zstd block does not decode");
+        return;
+#else
+        throw std::runtime_error("Session file uses zstd compression, which this build does not support");
+#endif
+    }
+    case Compression::lz4:
+    {
+#ifdef HAVE_LZ4
+        int n = LZ4_decompress_safe(src, raw.data(), static_cast<int>(storedSize), static_cast<int>(raw.size()));
+        if (n < 0 || static_cast<size_t>(n) != raw.size())
+            corrupt("LZ4 block does not decode");
+        return;
+#else
+        throw std::runtime_error("Session file uses LZ4 compression, which this build does not support");
+#endif
+    }
+    }
+    corrupt("unknown block codec");
+}
+
+static void writeSession(std::ostream &out, const std::vector<Message> &messages, const std::string &summary,
+                         size_t summaryCovers, uint64_t generation, Compression codec)
+{
+    if (!compressionAvailable(codec))
+        throw std::runtime_error("Requested compression is not available in this build");
+
+    // header is rewritten once the index offset is known
+    std::string header(HEADER_SIZE, '\0');
+    out.write(header.data(), static_cast<std::streamsize>(header.size()));
+    out.write(summary.data(), static_cast<std::streamsize>(summary.size()));
+    uint64_t offset = HEADER_SIZE + summary.size();
+
+    std::string index;
+    std::string raw;
+    std::string packed;
+    uint32_t blockCount = 0;
+    size_t blockFirst = 0;
+    raw.reserve(BLOCK_TARGET_SIZE + 4096);
+
+    auto flushBlock = [&](size_t end)
+    {
+        if (end == blockFirst)
+            return;
+        bool compressed = compressBlock(codec, raw, packed);
+        const std::string &stored = compressed ? packed : raw;
+        out.write(stored.data(), static_cast<std::streamsize>(stored.size()));
+
+        putU64(index, offset);
+        putU32(index, static_cast<uint32_t>(stored.size()));
+        putU32(index, static_cast<uint32_t>(raw.size()));
+        putU64(index, blockFirst);
+        putU32(index, static_cast<uint32_t>(end - blockFirst));
+        index += static_cast<char>(compressed ? codec : Compression::none);
+        index.append(3, '\0');
+
+        offset += stored.size();
+        ++blockCount;
+        blockFirst = end;
+        raw.clear();
+    };
+
+    for (size_t i = 0; i < messages.size(); ++i)
+    {
+        const Message &msg = messages[i];
+        if (msg.content.size() > 0xFFFFFFFFu)
+            throw std::runtime_error("Message too large for the binary session format");
+
+        raw += static_cast<char>(msg.role == Role::user ? 0 : 1);
+        putU64(raw, static_cast<uint64_t>(msg.timestamp));
+        putU32(raw, static_cast<uint32_t>(msg.content.size()));
+        raw.append(msg.content.data(), msg.content.size());
+
+        if (raw.size() >= BLOCK_TARGET_SIZE)
+            flushBlock(i + 1);
+    }
+    flushBlock(messages.size());
+
+    out.write(index.data(), static_cast<std::streamsize>(index.size()));
+
+    header.clear();
+    header.append(MAGIC, sizeof(MAGIC));
+    putU16(header, FORMAT_VERSION);
+    putU16(header, 0);
+    putU64(header, messages.size());
+    putU64(header, generation);
+    putU64(header, summaryCovers);
+    putU32(header, blockCount);
+    putU32(header, static_cast<uint32_t>(summary.size()));
+    putU64(header, offset);
+    out.seekp(0);
+    out.write(header.data(), static_cast<std::streamsize>(header.size()));
+}
+
+void writeBinarySession(const std::string &FILENAME, const std::vector<Message> &messages,
+                        const std::string &summary, size_t summaryCovers, uint64_t generation,
+                        Compression codec)
+{
+    std::ofstream out(FILENAME, std::ios::binary | std::ios::trunc);
+    if (!out)
+        throw std::runtime_error("Cannot open " + FILENAME + " for writing");
+    writeSession(out, messages, summary, summaryCovers, generation, codec);
+    out.close();
+    if (!out)
+        throw std::runtime_error("Failed writing " + FILENAME);
+}
+
+std::string encodeBinarySession(const std::vector<Message> &messages, const std::string &summary,
+                                size_t summaryCovers, uint64_t generation, Compression codec)
+{
+    std::ostringstream out(std::ios::binary);
+    writeSession(out, messages, summary, summaryCovers, generation, codec);
+    return out.str();
+}
+
+// Header fields needed to walk the block index
+struct SessionLayout
+{
+    uint16_t version = 0;
+    uint64_t messageCount = 0;
+    uint32_t blockCount = 0;
+    uint64_t indexOffset = 0;
+};
+
+static SessionLayout readLayout(const char *data, size_t size, LoadedHistory &out)
+{
+    if (size < HEADER_SIZE || !isBinarySession(data, size))
+        corrupt("bad header");
+
+    SessionLayout layout;
+    layout.version = static_cast<uint16_t>(getLE(data + 4, 2));
+    if (layout.version != 1 && layout.version != FORMAT_VERSION)
+        throw std::runtime_error("Unsupported session file version " + std::to_string(layout.version));
+
+    layout.messageCount = getLE(data + 8, 8);
+    out.generation = getLE(data + 16, 8);
+    out.summaryCovers = static_cast<size_t>(getLE(data + 24, 8));
+    layout.blockCount = static_cast<uint32_t>(getLE(data + 32, 4));
+    uint32_t summaryLength = static_cast<uint32_t>(getLE(data + 36, 4));
+    layout.indexOffset = getLE(data + 40, 8);
+
+    if (HEADER_SIZE + summaryLength > size || layout.indexOffset > size ||
+        (size - layout.indexOffset) / INDEX_ENTRY_SIZE < layout.blockCount)
+        corrupt("truncated file");
+    out.summary.assign(data + HEADER_SIZE, summaryLength);
+    return layout;
+}
+
+static const char *indexEntry(const char *data, const SessionLayout &layout, uint32_t block)
+{
+    return data + layout.indexOffset + static_cast<uint64_t>(block) * INDEX_ENTRY_SIZE;
+}
+
+// Decode blocks [firstBlock, endBlock) into out.messages; out.first is the first message they hold
+static void decodeBlocks(const char *data, const SessionLayout &layout, uint32_t firstBlock, uint32_t endBlock,
+                         LoadedHistory &out)
+{
+    out.messages.clear();
+    out.first = firstBlock < endBlock ? static_cast<size_t>(getLE(indexEntry(data, layout, firstBlock) + 16, 8))
+                                      : static_cast<size_t>(layout.messageCount);
+    if (out.first > layout.messageCount)
+        corrupt("bad block index");
+
+    std::string raw;
+    for (uint32_t b = firstBlock; b < endBlock; ++b)
+    {
+        const char *entry = indexEntry(data, layout, b);
+        uint64_t blockOffset = getLE(entry, 8);
+        uint32_t storedSize = static_cast<uint32_t>(getLE(entry + 8, 4));
+        uint32_t rawSize = static_cast<uint32_t>(getLE(entry + 12, 4));
+        uint64_t first = getLE(entry + 16, 8);
+        uint32_t count = static_cast<uint32_t>(getLE(entry + 24, 4));
+        Compression codec = static_cast<Compression>(static_cast<unsigned char>(entry[28]));
+
+        if (blockOffset > layout.indexOffset || storedSize > layout.indexOffset - blockOffset ||
+            first != out.first + out.messages.size() || count > layout.messageCount - first)
+            corrupt("bad block index");
+
+        raw.resize(rawSize);
+        decompressBlock(codec, data + blockOffset, storedSize, raw);
+
+        size_t pos = 0;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (pos + 1 > raw.size())
+                corrupt("truncated record");
+            Message msg;
+            msg.role = raw[pos] == 0 ? Role::user : Role::model;
+            ++pos;
+            if (layout.version == 1)
+            {
+                size_t tsLength = pos < raw.size() ? static_cast<unsigned char>(raw[pos]) : 0;
+                if (pos + 1 + tsLength > raw.size())
+                    corrupt("truncated record");
+                msg.timestamp = timestampFromText(std::string_view(raw.data() + pos + 1, tsLength));
+                pos += 1 + tsLength;
+            }
+            else
+            {
+                if (pos + 8 > raw.size())
+                    corrupt("truncated record");
+                msg.timestamp = static_cast<int64_t>(getLE(raw.data() + pos, 8));
+                pos += 8;
+            }
+            if (pos + 4 > raw.size())
+                corrupt("truncated record");
+            size_t contentLength = static_cast<size_t>(getLE(raw.data() + pos, 4));
+            pos += 4;
+            if (pos + contentLength > raw.size())
+                corrupt("truncated record");
+            msg.content = out.arena.store(std::string_view(raw.data() + pos, contentLength));
+            pos += contentLength;
+            out.messages.push_back(msg);
+        }
+    }
+}
+
+void readBinarySession(const char *data, size_t size, LoadedHistory &out)
+{
+    SessionLayout layout = readLayout(data, size, out);
+    out.messages.reserve(static_cast<size_t>(layout.messageCount));
+    decodeBlocks(data, layout, 0, layout.blockCount, out);
+    if (out.first != 0 || out.messages.size() != layout.messageCount)
+        corrupt("message count mismatch");
+}
+
+void readBinarySessionTail(const char *data, size_t size, size_t tail, LoadedHistory &out)
+{
+    SessionLayout layout = readLayout(data, size, out);
+    // walk the index back from the newest block until the blocks hold enough messages
+    uint32_t firstBlock = layout.blockCount;
+    uint64_t messages = 0;
+    while (firstBlock > 0 && messages < tail)
+    {
+        --firstBlock;
+        messages += getLE(indexEntry(data, layout, firstBlock) + 24, 4);
+    }
+    decodeBlocks(data, layout, firstBlock, layout.blockCount, out);
+    if (out.first + out.messages.size() != layout.messageCount)
+        corrupt("message count mismatch");
+}
+
+void readBinarySessionRange(const char *data, size_t size, size_t begin, size_t end, LoadedHistory &out)
+{
+    SessionLayout layout = readLayout(data, size, out);
+    // blocks are in message order: skip the ones ending before begin, stop at the first starting at end
+    uint32_t firstBlock = 0;
+    while (firstBlock < layout.blockCount)
+    {
+        const char *entry = indexEntry(data, layout, firstBlock);
+        if (getLE(entry + 16, 8) + getLE(entry + 24, 4) > begin)
+            break;
+        ++firstBlock;
+    }
+    uint32_t endBlock = firstBlock;
+    while (endBlock < layout.blockCount && getLE(indexEntry(data, layout, endBlock) + 16, 8) < end)
+        ++endBlock;
+    decodeBlocks(data, layout, firstBlock, endBlock, out);
+}
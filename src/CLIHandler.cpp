@@ -1,21 +1,137 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
 #include <iostream>
 #include <sstream>
 #include <map>
 #include <filesystem>
+#include <vector>
 
 
 #include "CLIHandler.h"
+#include "BinarySession.h"
+#include "Metrics.h"
+#include "Timestamp.h"
+#include <iomanip>
+
+// messages per /history page
+static const size_t HISTORY_PAGE = 50;
+
+// Parse the /history argument into a message range; false if it is not understood
+static bool historyRange(const std::string &arg, size_t total, size_t &from, size_t &count)
+{
+    std::istringstream iss(arg);
+    std::string word;
+    if (!(iss >> word))
+    {
+        from = total > HISTORY_PAGE ? total - HISTORY_PAGE : 0;
+        count = HISTORY_PAGE;
+        return true;
+    }
+    if (word == "all")
+    {
+        from = 0;
+        count = total;
+        return true;
+    }
+    if (word == "page")
+    {
+        size_t page = 0;
+        if (!(iss >> page) || page == 0)
+            return false;
+        from = (page - 1) * HISTORY_PAGE;
+        count = HISTORY_PAGE;
+        return true;
+    }
+
+    // <first>[-<last>], inclusive message numbers as /history and /search print them
+    char *end = nullptr;
+    from = std::strtoull(word.c_str(), &end, 10);
+    if (end == word.c_str())
+        return false;
+    count = HISTORY_PAGE;
+    if (*end == '-')
+    {
+        const char *lastText = end + 1;
+        size_t last = std::strtoull(lastText, &end, 10);
+        if (end == lastText || last < from)
+            return false;
+        count = last - from + 1;
+    }
+    return *end == '\0';
+}
+
+// hits shown by /search
+static const size_t SEARCH_RESULTS = 10;
+static const size_t SNIPPET_CHARS = 100;
+
+// One line of content around the first occurrence of a query word
+static std::string snippet(std::string_view content, const std::string &query)
+{
+    auto lower = [](std::string_view text)
+    {
+        std::string out(text);
+        for (char &c : out)
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        return out;
+    };
+    const std::string haystack = lower(content);
+    size_t hit = std::string::npos;
+    std::istringstream words(lower(query));
+    std::string word;
+    while (words >> word)
+    {
+        word.erase(std::remove(word.begin(), word.end(), '"'), word.end());
+        size_t at = word.size() > 1 ? haystack.find(word) : std::string::npos;
+        if (at < hit)
+            hit = at;
+    }
+
+    size_t begin = hit == std::string::npos || hit < SNIPPET_CHARS / 4 || content.size() <= SNIPPET_CHARS
+                       ? 0
+                       : hit - SNIPPET_CHARS / 4;
+    // never start or stop inside a UTF-8 sequence
+    while (begin > 0 && (static_cast<unsigned char>(content[begin]) & 0xC0) == 0x80)
+        --begin;
+    size_t end = std::min(content.size(), begin + SNIPPET_CHARS);
+    while (end < content.size() && (static_cast<unsigned char>(content[end]) & 0xC0) == 0x80)
+        ++end;
+
+    std::string out = begin > 0 ? "..." : "";
+    for (char c : content.substr(begin, end - begin))
+        out += (c == '\n' || c == '\r' || c == '\t') ? ' ' : c;
+    if (end < content.size())
+        out += "...";
+    return out;
+}
 
 static const std::map<std::string, std::string> COMMAND_HELP = {
     {"/help", "Show available commands"},
-    {"/new", "Start a new conversation"},
-    {"/clear", "Clear current conversation"},
-    {"/load", "Load conversation from file: /load <file>"},
-    {"/export", "Export conversation to Markdown: /export <file>"},
-    {"/history", "Show conversation history"},
+    {"/new", "Start a new session (the current one is kept): /new [title]"},
+    {"/sessions", "List saved sessions"},
+    {"/switch", "Switch to another session: /switch <id or title prefix>"},
+    {"/clear", "Clear the messages of the current session"},
+    {"/load", "Import a JSON or binary (.gcs) history file as a new session: /load <file>"},
+    {"/export", "Export conversation: /export <file> (.json = JSON, .gcs = binary, otherwise Markdown)"},
+    {"/history", "Show conversation history: /history [all | page <n> | <first>[-<last>]] (default: the latest page)"},
+    {"/search", "Search the current session: /search <words> (\"quoted phrases\" must match exactly)"},
+    {"/stats", "Show per-phase latency (p50/p90/p99) and request counters since the process started (all sessions and daemon clients)"},
+    {"/cancel", "Abort the request in progress (or press Ctrl-C while waiting)"},
     {"/exit", "Exit the application"}};
 
-bool handleCommand(const std::string &input, Conversation &convo, bool &shouldExit)
+void clearSession(SessionStore &store, std::ostream &out)
+{
+    Conversation &convo = store.current();
+    {
+        auto lock = store.lock();
+        convo.clearMessages();
+    }
+    store.markDirty();
+    out << "Cleared session " << store.currentInfo().id << ".\n";
+}
+
+static bool dispatchCommand(const std::string &input, SessionStore &store, bool &shouldExit, std::ostream &out,
+                            std::ostream &err, std::istream &in)
 {
     if (input.empty() || input[0] != '/')
     {
@@ -32,32 +148,80 @@ bool handleCommand(const std::string &input, Conversation &convo, bool &shouldEx
     // Handle commands
     if (command == "/help")
     {
-        std::cout << "\nAvailable commands:\n";
+        out << "\nAvailable commands:\n";
         for (const auto &[cmd, desc] : COMMAND_HELP)
         {
-            std::cout << "  " << cmd << " - " << desc << "\n";
+            out << "  " << cmd << " - " << desc << "\n";
         }
         return true;
     }
 
-    // Start a new conversation
+    // Start a new session; the current one stays on disk
     if (command == "/new")
     {
-        if (!convo.empty())
+        const SessionInfo &info = store.create(arg);
+        out << "Started session " << info.id << (arg.empty() ? "" : " (" + arg + ")") << ".\n";
+        return true;
+    }
+
+    // Discard the messages of the current session
+    if (command == "/clear")
+    {
+        Conversation &convo = store.current();
+        bool empty;
         {
-            std::cout << "Current conversation will be lost. Continue? (y/n): ";
+            auto lock = store.lock();
+            empty = convo.empty();
+        }
+        if (!empty)
+        {
+            out << "Current conversation will be lost. Continue? (y/n): ";
             std::string choice;
-            std::getline(std::cin, choice);
+            std::getline(in, choice);
 
             if (choice != "y" && choice != "Y")
             {
-                std::cout << "Cancelled. Conversation preserved.\n";
+                out << "Cancelled. Conversation preserved.\n";
                 return true;
             }
         }
 
-        convo.clearMessages();
-        std::cout << "Started a new conversation.\n";
+        clearSession(store, out);
+        return true;
+    }
+
+    if (command == "/sessions")
+    {
+        const std::string currentId = store.currentInfo().id;
+        out << "\n  " << std::left << std::setw(10) << "id" << std::setw(52) << "title" << std::right
+            << std::setw(9) << "messages" << "  last modified\n";
+        for (const SessionInfo &info : store.list())
+        {
+            out << (info.id == currentId ? "* " : "  ") << std::left << std::setw(10) << info.id
+                << std::setw(52) << (info.title.empty() ? "(untitled)" : info.title) << std::right
+                << std::setw(9) << info.messages << "  "
+                << (info.modified ? formatTimestamp(info.modified) : "-")
+                << (store.isResident(info.id) ? "" : "  (on disk)") << "\n";
+        }
+        return true;
+    }
+
+    if (command == "/switch")
+    {
+        if (arg.empty())
+        {
+            err << "Error: session required. Usage: /switch <id or title prefix>\n";
+            return true;
+        }
+        if (!store.switchTo(arg))
+        {
+            err << "Error: no single session matches '" << arg << "'. Use /sessions to list them.\n";
+            return true;
+        }
+        const SessionInfo &info = store.currentInfo();
+        Conversation &convo = store.current();
+        auto lock = store.lock();
+        out << "Switched to session " << info.id << " (" << convo.size() << " message(s)).\n";
         return true;
     }
 
@@ -65,7 +229,20 @@ bool handleCommand(const std::string &input, Conversation &convo, bool &shouldEx
     if (command == "/exit")
     {
         shouldExit = true;
-        std::cout << "Exiting the application. Goodbye!\n";
+        out << "Exiting the application. Goodbye!\n";
+        return true;
+    }
+
+    if (command == "/stats")
+    {
+        out << "\n" << metrics().report();
+        return true;
+    }
+
+    // Only meaningful while a request is running; main.cpp reads it from stdin then
+    if (command == "/cancel")
+    {
+        out << "No request in progress.\n";
         return true;
     }
 
@@ -75,7 +252,7 @@ bool handleCommand(const std::string &input, Conversation &convo, bool &shouldEx
     {
         if (arg.empty())
         {
-            std::cerr << "Error: filename required. Usage: /load <file>\n";
+            err << "Error: filename required. Usage: /load <file>\n";
             return true;
         }
 
@@ -83,51 +260,134 @@ bool handleCommand(const std::string &input, Conversation &convo, bool &shouldEx
 
         if (!std::filesystem::exists(filePath))
         {
-            std::cerr << "Error: file does not exist.\n";
+            err << "Error: file does not exist.\n";
             return true;
         }
 
         if (!std::filesystem::is_regular_file(filePath))
         {
-            std::cerr << "Error: not a regular file.\n";
+            err << "Error: not a regular file.\n";
             return true;
         }
 
-        if (!convo.loadFromFile(filePath.string())) {
-            std::cerr << "Error loading file: " << filePath << "\n";
+        if (!store.import(filePath.string())) {
+            err << "Error loading file: " << filePath << "\n";
+            return true;
         }
+        out << "Imported as session " << store.currentInfo().id << ".\n";
 
         return true;
     }
 
     // Exporting conversation to Markdown
     if (command == "/export")
+    {
+        Conversation &convo = store.current();
+        if (arg.empty())
+        {
+            out << "Error: filename required. Usage: /export <file>\n";
+            return true;
+        }
+
+        // exporting reads messages that may still be on disk, like the writer thread does
+        auto lock = store.lock();
+        try
+        {
+            // JSON and binary sessions go through saveToFile, which picks the format from the extension
+            std::string extension = std::filesystem::path(arg).extension().string();
+            if (extension == ".json" || extension == BINARY_SESSION_EXTENSION)
+            {
+                if (!convo.saveToFile(arg))
+                {
+                    out << "Error exporting conversation to " << arg << "\n";
+                    return true;
+                }
+            }
+            else
+            {
+                convo.exportToMarkdown(arg);
+            }
+            out << "Conversation exported to " << arg << "\n";
+        }
+        catch (const std::exception &e)
+        {
+            out << "Error exporting conversation: " << e.what() << "\n";
+        }
+        return true;
+    }
+
+    // Ranked full-text search over the current session
+    if (command == "/search")
     {
         if (arg.empty())
         {
-            std::cout << "Error: filename required. Usage: /export <file>\n";
+            err << "Error: query required. Usage: /search <words>\n";
             return true;
         }
 
+        // current() takes the store lock itself, so fetch the conversation first
+        Conversation &convo = store.current();
+        auto lock = store.lock();
+
+        // a hit that is still on disk is decoded on its own, not the whole history with it
+        auto show = [&](size_t index, const Message &msg)
+        {
+            out << "  #" << std::left << std::setw(8) << index << std::right << "["
+                << formatTimestamp(msg.timestamp) << "] " << Conversation::roleToString(msg.role) << ": "
+                << snippet(msg.content, arg) << "\n";
+        };
+        // building the index reads every message, and a hit's message may be in a block that cannot be read
+        std::vector<std::pair<size_t, double>> hits;
+        double ms = 0;
         try
         {
-            convo.exportToMarkdown(arg);
-            std::cout << "Conversation exported to " << arg << "\n";
+            ScopedTimer timer("search.query");
+            hits = convo.relevanceIndex().find(arg, SEARCH_RESULTS);
+            ms = timer.stop();
+            for (const auto &hit : hits)
+                convo.forEachMessage(hit.first, hit.first + 1, show);
         }
         catch (const std::exception &e)
         {
-            std::cout << "Error exporting conversation: " << e.what() << "\n";
+            err << "Error searching the session: " << e.what() << "\n";
         }
+        out << "(" << hits.size() << (hits.size() == 1 ? " hit" : " hits") << " in " << std::fixed
+            << std::setprecision(2) << ms << " ms, " << convo.size() << " message(s) searched)\n"
+            << std::defaultfloat;
         return true;
     }
 
     // Print conversation history
     if (command == "/history")
     {
-        convo.printHistory();
+        Conversation &convo = store.current();
+        auto lock = store.lock();
+        size_t from = 0;
+        size_t count = 0;
+        if (!historyRange(arg, convo.size(), from, count))
+        {
+            err << "Error: expected /history, /history all, /history page <n> or /history <first>[-<last>]\n";
+            return true;
+        }
+        convo.printHistory(from, count, out, err);
         return true;
     }
 
-    std::cout << "Unknown command: " << command << "Use /help for commands." << "\n";
+    out << "Unknown command: " << command << "Use /help for commands." << "\n";
     return true; // Command was handled
+}
+
+bool handleCommand(const std::string &input, SessionStore &store, bool &shouldExit, std::ostream &out,
+                   std::ostream &err, std::istream &in)
+{
+    // a session that cannot be read right now fails the command, not the program
+    try
+    {
+        return dispatchCommand(input, store, shouldExit, out, err, in);
+    }
+    catch (const std::exception &e)
+    {
+        err << "Error: " << e.what() << "\n";
+        return true;
+    }
 }
\ No newline at end of file
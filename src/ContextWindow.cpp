@@ -0,0 +1,255 @@
+#include "ContextWindow.h"
+#include <algorithm>
+#include <nlohmann/json.hpp>
+
+// per-entry cost of role and structure in the request
+static const size_t MESSAGE_OVERHEAD_TOKENS = 4;
+
+size_t estimateTokens(std::string_view text)
+{
+    size_t asciiBytes = 0;
+    size_t codePoints = 0;
+    for (unsigned char c : text)
+    {
+        if (c < 0x80)
+            ++asciiBytes;
+        else if ((c & 0xC0) != 0x80) // lead byte of a multi-byte sequence
+            ++codePoints;
+    }
+    return (asciiBytes + 3) / 4 + codePoints + MESSAGE_OVERHEAD_TOKENS;
+}
+
+// Walk back from the newest message while the budget allows; the newest message is always kept.
+// The window is moved forward to start on a user turn when it had to be cut.
+static size_t windowStart(const std::vector<Message> &messages, size_t from, size_t budget, size_t &tokens)
+{
+    size_t start = messages.size();
+    tokens = 0;
+    while (start > from)
+    {
+        size_t cost = messages[start - 1].tokens;
+        if (start < messages.size() && tokens + cost > budget)
+            break;
+        tokens += cost;
+        --start;
+    }
+
+    if (start > from)
+    {
+        while (start + 1 < messages.size() && messages[start].role != Role::user)
+        {
+            tokens -= messages[start].tokens;
+            ++start;
+        }
+    }
+    return start;
+}
+
+// windowStart over the whole conversation (from and the result are message indexes), reading messages that are
+// still on disk only when the window reaches past the resident tail
+static size_t recentWindowStart(const Conversation &convo, size_t from, size_t budget, size_t &tokens)
+{
+    const size_t base = convo.firstResident();
+    const auto &recent = convo.recentMessages();
+    if (from >= base)
+        return base + windowStart(recent, from - base, budget, tokens);
+    size_t start = windowStart(recent, 0, budget, tokens);
+    if (start > 0 || base == 0)
+        return base + start;
+    return windowStart(convo.getMessages(), from, budget, tokens);
+}
+
+ContextSelection FullHistoryPolicy::select(const Conversation &convo, size_t) const
+{
+    ContextSelection selection;
+    const auto &messages = convo.getMessages();
+    for (const auto &msg : messages)
+        selection.tokens += msg.tokens;
+    if (!messages.empty())
+        selection.ranges.emplace_back(0, messages.size());
+    return selection;
+}
+
+ContextSelection SlidingWindowPolicy::select(const Conversation &convo, size_t budget) const
+{
+    ContextSelection selection;
+    size_t start = recentWindowStart(convo, 0, budget, selection.tokens);
+    if (start < convo.size())
+        selection.ranges.emplace_back(start, convo.size());
+    return selection;
+}
+
+ContextSelection PinFirstPolicy::select(const Conversation &convo, size_t budget) const
+{
+    ContextSelection selection;
+    const size_t total = convo.size();
+    size_t pin = std::min(pinned, total);
+
+    // only the blocks holding the pinned messages are read, not the whole history
+    size_t pinTokens = 0;
+    convo.forEachMessage(0, pin, [&](size_t, const Message &msg)
+                         { pinTokens += msg.tokens; });
+
+    size_t tailTokens = 0;
+    size_t start = recentWindowStart(convo, pin, budget > pinTokens ? budget - pinTokens : 0, tailTokens);
+    selection.tokens = pinTokens + tailTokens;
+
+    if (start == pin)
+    {
+        // pinned prefix and window touch: one contiguous range
+        if (total > 0)
+            selection.ranges.emplace_back(0, total);
+        return selection;
+    }
+    if (pin > 0)
+        selection.ranges.emplace_back(0, pin);
+    selection.ranges.emplace_back(start, total);
+    return selection;
+}
+
+ContextSelection SummaryPolicy::select(const Conversation &convo, size_t budget) const
+{
+    ContextSelection selection;
+    const size_t total = convo.size();
+
+    size_t start = recentWindowStart(convo, 0, budget, selection.tokens);
+    if (start == 0)
+    {
+        if (total > 0)
+            selection.ranges.emplace_back(0, total);
+        return selection;
+    }
+
+    // history does not fit: the summary replaces everything it covers
+    size_t covered = std::min(convo.summaryCoverage(), total);
+    size_t summaryTokens = convo.getSummary().empty() ? 0 : estimateTokens(convo.getSummary());
+    start = recentWindowStart(convo, covered, budget > summaryTokens ? budget - summaryTokens : 0, selection.tokens);
+
+    selection.summary = convo.getSummary();
+    selection.tokens += summaryTokens;
+    selection.unsummarized = start - covered;
+    if (start < total)
+        selection.ranges.emplace_back(start, total);
+    return selection;
+}
+
+ContextSelection RelevancePolicy::select(const Conversation &convo, size_t budget) const
+{
+    ContextSelection selection;
+    const size_t total = convo.size();
+    if (total == 0)
+        return selection;
+
+    // the recent tail, as far as the budget allows
+    size_t from = total > recent ? total - recent : 0;
+    size_t start = recentWindowStart(convo, from, budget, selection.tokens);
+
+    // the newest prompt is the query (the message just added, so never one still on disk)
+    const auto &resident = convo.recentMessages();
+    std::string queryText;
+    for (size_t i = resident.size(); i > 0; --i)
+    {
+        queryText = resident[i - 1].content;
+        if (resident[i - 1].role == Role::user)
+            break;
+    }
+
+    // earlier turns by relevance, while they fit; ask for spare hits since some share a turn
+    size_t remaining = budget > selection.tokens ? budget - selection.tokens : 0;
+    std::vector<std::pair<size_t, size_t>> picked;
+    if (start > 0 && turns > 0 && remaining > 0)
+    {
+        auto hits = convo.relevanceIndex().search(queryText, turns * 4, start);
+        for (const auto &hit : hits)
+        {
+            if (picked.size() == turns)
+                break;
+            // the hit and its neighbours, read without loading the rest of the history
+            const size_t first = hit.first > 0 ? hit.first - 1 : 0;
+            std::vector<Message> around;
+            convo.forEachMessage(first, std::min(hit.first + 2, start), [&](size_t, const Message &msg)
+                                 { around.push_back(msg); });
+            auto at = [&](size_t index) -> const Message &
+            { return around[index - first]; };
+
+            // the turn around the hit: a prompt with its reply, or a reply with its prompt
+            size_t begin = hit.first;
+            size_t end = hit.first + 1;
+            if (at(begin).role == Role::user && end < start && at(end).role == Role::model)
+                ++end;
+            else if (at(begin).role == Role::model && begin > 0 && at(begin - 1).role == Role::user)
+                --begin;
+
+            bool overlaps = std::any_of(picked.begin(), picked.end(), [&](const std::pair<size_t, size_t> &turn)
+                                        { return begin < turn.second && turn.first < end; });
+            if (overlaps)
+                continue;
+            size_t cost = 0;
+            for (size_t i = begin; i < end; ++i)
+                cost += at(i).tokens;
+            if (cost > remaining)
+                continue;
+            remaining -= cost;
+            selection.tokens += cost;
+            picked.emplace_back(begin, end);
+        }
+    }
+
+    // conversation order, adjacent turns (and the tail) merged into single ranges
+    std::sort(picked.begin(), picked.end());
+    picked.emplace_back(start, total);
+    for (const auto &range : picked)
+    {
+        if (range.first >= range.second)
+            continue;
+        if (!selection.ranges.empty() && selection.ranges.back().second == range.first)
+            selection.ranges.back().second = range.second;
+        else
+            selection.ranges.push_back(range);
+    }
+    return selection;
+}
+
+std::unique_ptr<ContextPolicy> makeContextPolicy(const std::string &name, size_t pinned,
+                                                 size_t relevantTurns, size_t recentMessages)
+{
+    if (name == "all")
+        return std::make_unique<FullHistoryPolicy>();
+    if (name == "window")
+        return std::make_unique<SlidingWindowPolicy>();
+    if (name == "pin")
+        return std::make_unique<PinFirstPolicy>(pinned);
+    if (name == "summary")
+        return std::make_unique<SummaryPolicy>();
+    if (name == "relevance")
+        return std::make_unique<RelevancePolicy>(relevantTurns, recentMessages);
+    return nullptr;
+}
+
+std::string buildSummaryRequest(const Conversation &convo, size_t from, size_t to)
+{
+    std::string prompt =
+        "Summarize the conversation below so it can replace the original messages as context for "
+        "continuing it. Keep facts, decisions, names, code identifiers and open questions. "
+        "Reply with the summary only.\n\n";
+    if (!convo.getSummary().empty())
+    {
+        prompt += "Summary of the conversation so far:\n";
+        prompt += convo.getSummary();
+        prompt += "\n\n";
+    }
+    prompt += "Messages:\n";
+    auto addLine = [&prompt](size_t, const Message &msg)
+    {
+        prompt += Conversation::roleToString(msg.role);
+        prompt += ": ";
+        prompt += msg.content;
+        prompt += "\n";
+    };
+    // the messages being folded are usually old ones still on disk: only their blocks are decoded
+    convo.forEachMessage(from, to, addLine);
+
+    nlohmann::json request;
+    request["contents"] = nlohmann::json::array({{{"role", "user"}, {"parts", nlohmann::json::array({{{"text", prompt}}})}}});
+    return request.dump();
+}
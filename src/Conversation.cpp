@@ -1,6 +1,11 @@
 #include "Conversation.h"
-#include <chrono>
-#include <ctime>
+#include "ContextWindow.h"
+#include "HistoryReader.h"
+#include "MappedFile.h"
+#include "BinarySession.h"
+#include "Timestamp.h"
+#include "FileSync.h"
+#include "Metrics.h"
 #include <string>
 #include <vector>
 #include <fstream>
@@ -8,64 +13,114 @@
 #include <cerrno>
 #include <cstring>
 #include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <new>
 
-// Formating the timestamp as "YYYY-MM-DD HH:MM:SS"
-std::string Conversation::currentTimestamp() const
-{
-    auto now = std::chrono::system_clock::now();
-    std::time_t now_time_t = std::chrono::system_clock::to_time_t(now);
-    std::tm now_tm;
-#if defined(_POSIX_VERSION) || defined(__linux__)
-    localtime_r(&now_time_t, &now_tm);
-#else
-    const std::tm *tmp = std::localtime(&now_time_t);
-    if (tmp)
-        now_tm = *tmp;
-#endif
-    char buffer[20];
-    std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &now_tm);
-    return std::string(buffer);
-}
-
-// Convert Role enum to string for storage in Message struct
+Conversation::Conversation() : binaryCompression(defaultCompression()) {}
+
+// Convert Role enum to string for storage and display
 std::string Conversation::roleToString(Role role)
 {
     return (role == Role::user) ? "user" : "model";
 }
 
+Role Conversation::roleFromString(std::string_view role)
+{
+    bool isUser = role.size() == 4 &&
+                  std::equal(role.begin(), role.end(), "user",
+                             [](char a, char b) { return std::tolower(static_cast<unsigned char>(a)) == b; });
+    return isUser ? Role::user : Role::model;
+}
+
 // Add a new message to the Conversation with the current timestamp
-void Conversation::addMessage(Role role, const std::string &content)
+void Conversation::addMessage(Role role, std::string_view content)
+{
+    addMessage(role, content, currentEpochSeconds());
+}
+
+void Conversation::addMessage(Role role, std::string_view content, int64_t timestamp)
 {
     Message msg;
-    msg.role = roleToString(role);
-    msg.content = content;
-    msg.timestamp = currentTimestamp();
+    msg.role = role;
+    msg.content = arena.store(content);
+    msg.timestamp = timestamp;
     // Time complexity: O(1) - Adding a message to the end of the vector is constant time.
     messages.push_back(msg);
+    indexMessage(messages.back());
+    enforceMemoryLimit();
 }
 
 // Return a const reference to the messages vector for read-only access
 const std::vector<Message> &Conversation::getMessages() const
 {
+    faultIn();
     return messages;
 }
 
+const std::vector<Message> &Conversation::recentMessages() const
+{
+    return messages;
+}
+
+size_t Conversation::firstResident() const
+{
+    return pagedOut;
+}
+
+// messages decoded at a time from the part of a lazily opened snapshot that is still on disk
+static const size_t PAGED_DECODE_MESSAGES = 4096;
+
+void Conversation::forEachMessage(size_t from, size_t to, const std::function<void(size_t, const Message &)> &visit) const
+{
+    to = std::min(to, size());
+    while (from < std::min(to, pagedOut))
+    {
+        LoadedHistory loaded;
+        const size_t end = std::min({to, pagedOut, from + PAGED_DECODE_MESSAGES});
+        readPaged(from, end, loaded);
+        for (; from < end; ++from)
+        {
+            Message &msg = loaded.messages[from - loaded.first];
+            msg.tokens = static_cast<uint32_t>(estimateTokens(msg.content));
+            visit(from, msg);
+        }
+    }
+    for (; from < to; ++from)
+        visit(from, messages[from - pagedOut]);
+}
+
 // Clear all messages from the Conversation
 void Conversation::clearMessages()
 {
     messages.clear();
+    arena.clear();
+    pagedOut = 0;
+    pagedFile.clear();
+    pagedMap.close();
+    geminiContents.clear();
+    contentOffsets.clear();
+    resetSpill();
+    spill.reset();
+    relevance.clear();
+    relevanceFile.clear();
+    summary.clear();
+    summaryCovers = 0;
+    // the on-disk journal no longer describes this history; next persist writes a snapshot
+    journalValid = false;
+    ++journalResets;
 }
 
 // Check if the Conversation is empty
 bool Conversation::empty() const
 {
-    return messages.empty();
+    return pagedOut == 0 && messages.empty();
 }
 
 // Return the number of messages in the Conversation
 size_t Conversation::size() const
 {
-    return messages.size();
+    return pagedOut + messages.size();
 }
 
 // PHASE 2 - Persistence and JSON
@@ -73,14 +128,20 @@ size_t Conversation::size() const
 // Serialize the Conversation to JSON format
 nlohmann::json Conversation::toJson() const
 {
+    faultIn();
     nlohmann::json jsondata;
+    jsondata["generation"] = journalGeneration;
+    if (!summary.empty())
+    {
+        jsondata["summary"] = {{"text", summary}, {"covers", summaryCovers}};
+    }
     jsondata["messages"] = nlohmann::json::array();
     for (const auto &msg : messages)
     {
         nlohmann::json msgJson;
-        msgJson["role"] = msg.role;
+        msgJson["role"] = roleToString(msg.role);
         msgJson["content"] = msg.content;
-        msgJson["timestamp"] = msg.timestamp;
+        msgJson["timestamp"] = formatTimestamp(msg.timestamp);
         jsondata["messages"].push_back(msgJson);
     }
     return jsondata;
@@ -96,7 +157,7 @@ void Conversation::fromJson(const nlohmann::json &jsondata)
     }
 
     // laoding Messages from JSON array to memeory
-    std::vector<Message> loadedMessages;
+    LoadedHistory loaded;
     for (const auto &MJSON : jsondata["messages"])
     {
         // Validate each message object
@@ -104,14 +165,41 @@ void Conversation::fromJson(const nlohmann::json &jsondata)
             throw std::runtime_error("Invalid Messages format in JSon should be {role,content,timestamp}");
 
         Message msg;
-        msg.role = MJSON["role"].get<std::string>();
-        msg.content = MJSON["content"].get<std::string>();
-        msg.timestamp = MJSON["timestamp"].get<std::string>();
+        msg.role = roleFromString(MJSON["role"].get<std::string>());
+        msg.content = loaded.arena.store(MJSON["content"].get<std::string>());
+        msg.timestamp = timestampFromJson(MJSON["timestamp"]);
 
-        loadedMessages.push_back(msg);
+        loaded.messages.push_back(msg);
+    }
+    if (jsondata.contains("summary") && jsondata["summary"].is_object())
+    {
+        loaded.summary = jsondata["summary"].value("text", "");
+        loaded.summaryCovers = jsondata["summary"].value("covers", size_t(0));
     }
+    loaded.generation = jsondata.value("generation", uint64_t(0));
     // laoding into memory after validation
-    messages = std::move(loadedMessages);
+    adoptHistory(std::move(loaded));
+}
+
+// Replace the in-memory state with a validated, fully loaded history
+void Conversation::adoptHistory(LoadedHistory &&loaded)
+{
+    messages = std::move(loaded.messages);
+    arena = std::move(loaded.arena);
+    pagedOut = loaded.first;
+    pagedFile.clear();
+    pagedMap.close();
+    // nothing points into the old spill file any more
+    resetSpill();
+    spill.reset();
+    rebuildIndex();
+    relevance.clear();
+    relevanceFile.clear();
+    summary = std::move(loaded.summary);
+    summaryCovers = std::min(loaded.summaryCovers, size());
+    loadedGeneration = loaded.generation;
+    journalValid = false;
+    ++journalResets;
 }
 
 // saving to JSON file data/chat_history.json
@@ -121,21 +209,34 @@ bool Conversation::saveToFile(const std::string &FILENAME) const
 
     try
     {
-        std::ofstream out(tempfile);
-        if (!out)
-            return false;
+        // a snapshot holds every message, including those not read yet
+        faultIn();
+        if (std::filesystem::path(FILENAME).extension() == BINARY_SESSION_EXTENSION)
+        {
+            writeBinarySession(tempfile, messages, summary, summaryCovers, journalGeneration, binaryCompression);
+        }
+        else
+        {
+            std::ofstream out(tempfile);
+            if (!out)
+                return false;
 
-        // writing the JSON data to file with pretty printing (indentation of 2 spaces)
-        out << toJson().dump(2);
-        out.close();
+            // writing the JSON data to file with pretty printing (indentation of 2 spaces)
+            out << toJson().dump(2);
+            out.close();
+            if (!out)
+                return false;
+        }
 
-        // attempt to remove old file (ignore if it doesn't exist)
-        if (std::remove(FILENAME.c_str()) != 0 && errno != ENOENT)
+        // the data must be on disk before the rename publishes it, or a crash can leave an empty file behind
+        if (!syncFile(tempfile))
         {
-            std::cerr << "Warning: failed to remove old file " << FILENAME << ": " << std::strerror(errno) << "\n";
+            std::cerr << "Error: failed to sync " << tempfile << ": " << std::strerror(errno) << "\n";
+            std::remove(tempfile.c_str());
+            return false;
         }
 
-        // rename tempfile to final filename
+        // rename replaces the old file atomically, so there is never a moment without a history file
         if (std::rename(tempfile.c_str(), FILENAME.c_str()) != 0)
         {
             std::cerr << "Error: failed to rename " << tempfile << " to " << FILENAME << ": " << std::strerror(errno) << "\n";
@@ -144,10 +245,17 @@ bool Conversation::saveToFile(const std::string &FILENAME) const
             return false;
         }
 
+        // and the rename itself is only durable once the directory is synced
+        if (!syncParentDirectory(FILENAME))
+        {
+            std::cerr << "Warning: failed to sync the directory of " << FILENAME << ": " << std::strerror(errno) << "\n";
+        }
         return true;
     }
-    catch (...)
+    catch (const std::exception &e)
     {
+        std::cerr << "Error: failed to write " << FILENAME << ": " << e.what() << "\n";
+        std::remove(tempfile.c_str());
         return false;
     }
 }
@@ -155,42 +263,279 @@ bool Conversation::saveToFile(const std::string &FILENAME) const
 // laoding th file from disk
 bool Conversation::loadFromFile(const std::string &FILENAME)
 {
+    bool corrupt = false;
+    return loadSnapshot(FILENAME, 0, corrupt);
+}
+
+// tail > 0 decodes only the newest blocks of a binary snapshot; the rest is faulted in from FILENAME later
+bool Conversation::loadSnapshot(const std::string &FILENAME, size_t tail, bool &corrupt)
+{
+    corrupt = false;
     try
     {
-        std::ifstream in(FILENAME);
-        if (!in)
+        // map the file and stream it through the SAX loader: no stream copy, no DOM
+        MappedFile file;
+        std::string error;
+        if (!file.open(FILENAME, error))
         {
-
+            std::cerr << "Error loading conversation from file: " << FILENAME << ": " << error << "\n";
+            // an empty snapshot is a torn one; anything else is the file system refusing for now
+            std::error_code ec;
+            corrupt = std::filesystem::file_size(FILENAME, ec) == 0 && !ec;
             return false;
         }
-        // parsing the JSON data from file
-        nlohmann::json jsondata;
-        in >> jsondata;
-        fromJson(jsondata);
+        // binary sessions are recognised by their magic, whatever the extension
+        LoadedHistory loaded;
+        if (isBinarySession(file.data(), file.size()))
+        {
+            if (tail > 0)
+                readBinarySessionTail(file.data(), file.size(), tail, loaded);
+            else
+                readBinarySession(file.data(), file.size(), loaded);
+        }
+        else
+        {
+            parseHistoryJson(file.data(), file.data() + file.size(), loaded);
+        }
+        adoptHistory(std::move(loaded));
+        if (pagedOut > 0)
+        {
+            pagedFile = FILENAME;
+            pagedMap = std::move(file);
+        }
         std::cout << "Loading conversation from file: " << FILENAME << "\n";
         return true;
     }
+    catch (const std::bad_alloc &)
+    {
+        std::cerr << "Error loading conversation from file: " << FILENAME << ": out of memory\n";
+        return false;
+    }
     catch (const std::exception &e)
     {
         std::cerr << "Error loading conversation from file: " << FILENAME << ": " << e.what() << "\n";
+        corrupt = true;
         return false;
     }
 }
 
+// Read the messages a lazily opened snapshot left on disk and put them in front of the resident ones.
+// Throws if the snapshot can no longer be read: going on without them would lose history.
+void Conversation::faultIn() const
+{
+    if (pagedOut == 0)
+        return;
+
+    LoadedHistory loaded;
+    readPaged(0, pagedOut, loaded);
+
+    // the spilled prefix has to start at message 0, so spilled bodies come back into the arena (and the
+    // segment is dropped) before older messages go in front of them
+    for (size_t i = 0; i < spilledMessages; ++i)
+        messages[i].content = arena.store(messages[i].content);
+    resetSpill();
+    spill.reset();
+
+    arena.adopt(std::move(loaded.arena));
+    loaded.messages.insert(loaded.messages.end(), messages.begin(), messages.end());
+    messages.swap(loaded.messages);
+    pagedOut = 0;
+    pagedFile.clear();
+    pagedMap.close();
+    rebuildIndex();
+}
+
+void Conversation::readPaged(size_t from, size_t to, LoadedHistory &loaded) const
+{
+    readBinarySessionRange(pagedMap.data(), pagedMap.size(), from, to, loaded);
+    if (loaded.generation != loadedGeneration || loaded.first > from || loaded.first + loaded.messages.size() < to)
+        throw std::runtime_error("cannot read earlier messages from " + pagedFile + ": the file has changed");
+}
+
+// Load the snapshot (if any) and replay the journal written since it
+bool Conversation::openSession(const std::string &FILENAME, bool &corrupt)
+{
+    bool ok = true;
+    corrupt = false;
+    std::error_code ec;
+    const bool present = std::filesystem::exists(FILENAME, ec);
+    if (ec)
+    {
+        std::cerr << "Error loading conversation from file: " << FILENAME << ": " << ec.message() << "\n";
+        return false;
+    }
+    if (present)
+    {
+        ok = loadSnapshot(FILENAME, tailMessages, corrupt);
+        if (!ok)
+            return false;
+        journalGeneration = loadedGeneration;
+    }
+    else
+    {
+        clearMessages();
+        journalGeneration = 0;
+    }
+
+    // the search index saved with this snapshot is read when first needed
+    size_t snapshotCount = size();
+    if (snapshotCount > 0)
+    {
+        relevanceFile = FILENAME + ".index";
+        relevanceDocuments = snapshotCount;
+    }
+
+    journal = Journal(FILENAME + ".journal");
+    journalValid = journal.replay(journalGeneration, messages, arena, pagedOut);
+    journaledCount = size();
+
+    if (size() > snapshotCount)
+    {
+        for (size_t i = snapshotCount - pagedOut; i < messages.size(); ++i)
+            indexMessage(messages[i]);
+        enforceMemoryLimit();
+
+        std::cout << "Recovered " << (size() - snapshotCount) << " message(s) from journal: " << journal.getPath() << "\n";
+    }
+    return ok;
+}
+
+// Persist the messages added since the last call: O(new messages) unless a compaction is due
+bool Conversation::persist(const std::string &FILENAME)
+{
+    PendingSave save;
+    bool written = prepareSave(FILENAME, save) && writeSave(save);
+    finishSave(save, written);
+    return written;
+}
+
+bool Conversation::compact(const std::string &FILENAME)
+{
+    PendingSave save;
+    bool written = prepareSave(FILENAME, save, true) && writeSave(save);
+    finishSave(save, written);
+    return written;
+}
+
+bool Conversation::prepareSave(const std::string &FILENAME, PendingSave &save, bool compaction)
+{
+    save.path = FILENAME;
+    save.upTo = size();
+    save.resets = journalResets;
+    save.compaction = compaction || !journalValid || journal.getPath() != FILENAME + ".journal" ||
+                      journal.records() >= compactThreshold;
+    if (!save.compaction)
+    {
+        save.records = Journal::encode(messages, journaledCount, pagedOut);
+        save.recordCount = size() - journaledCount;
+        return true;
+    }
+
+    // A compaction writes a full snapshot under a new generation and then truncates the journal.
+    // If we crash between the two steps the old journal carries the previous generation and is ignored on replay.
+    ++journalGeneration;
+    journalValid = false;
+    save.generation = journalGeneration;
+    try
+    {
+        // a snapshot holds every message; those not read yet are decoded for it and dropped again
+        if (std::filesystem::path(FILENAME).extension() == BINARY_SESSION_EXTENSION)
+        {
+            LoadedHistory older;
+            if (pagedOut > 0)
+                readPaged(0, pagedOut, older);
+            older.messages.resize(pagedOut);
+            older.messages.insert(older.messages.end(), messages.begin(), messages.end());
+            save.snapshot = encodeBinarySession(older.messages, summary, summaryCovers, journalGeneration, binaryCompression);
+        }
+        else
+        {
+            save.snapshot = toJson().dump(2);
+        }
+        // an index that would have to be built from scratch is left to the first search that needs it
+        loadSavedIndex();
+        if (relevance.size() > 0)
+            save.searchIndex = relevanceIndex().serialize(journalGeneration);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: failed to write " << FILENAME << ": " << e.what() << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool Conversation::writeSave(const PendingSave &save)
+{
+    const std::string journalPath = save.path + ".journal";
+    if (!save.compaction)
+        return Journal::appendRecords(journalPath, save.records);
+
+    if (!replaceFile(save.path, save.snapshot))
+    {
+        std::cerr << "Error: failed to write " << save.path << ": " << std::strerror(errno) << "\n";
+        return false;
+    }
+    if (!Journal::create(journalPath, save.generation))
+        return false;
+    // a missing or stale index only costs a rebuild when the session is next searched
+    if (!save.searchIndex.empty() && !replaceFile(save.path + ".index", save.searchIndex))
+        std::cerr << "Warning: failed to write the search index " << save.path << ".index\n";
+    return true;
+}
+
+void Conversation::finishSave(const PendingSave &save, bool written)
+{
+    // a failed append may have left a torn record behind, and a history cleared or replaced while the files
+    // were written no longer matches them: start over from a snapshot next time
+    if (!written || save.resets != journalResets)
+    {
+        journalValid = false;
+        return;
+    }
+    if (save.compaction)
+    {
+        journal = Journal(save.path + ".journal");
+        journalValid = true;
+    }
+    else
+    {
+        journal.recorded(save.recordCount);
+    }
+    journaledCount = save.upTo;
+}
+
+void Conversation::setCompactThreshold(size_t records)
+{
+    compactThreshold = records;
+}
+
+void Conversation::setBinaryCompression(Compression codec)
+{
+    binaryCompression = codec;
+}
+
+void Conversation::setTailMessages(size_t count)
+{
+    tailMessages = count;
+}
+
+void Conversation::setMemoryLimit(size_t bytes, const std::string &dir)
+{
+    memoryLimit = bytes;
+    spillDir = dir;
+    enforceMemoryLimit();
+}
 
 // Convert the Conversation to Gemini API format
 nlohmann::json Conversation::toGeminiFormat() const {
+    faultIn();
     nlohmann::json j;
     j["contents"] = nlohmann::json::array();
 
     for (const auto& msg : messages) {
         nlohmann::json content;
-        // Normalize role strings to Gemini expected values
-        std::string roleLower = msg.role;
-        std::transform(roleLower.begin(), roleLower.end(), roleLower.begin(),
-                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
-        if (roleLower == "user") content["role"] = "user";
-        else content["role"] = "model";
+        content["role"] = roleToString(msg.role);
 
         // Parts MUST be an array
         content["parts"] = nlohmann::json::array({
@@ -202,31 +547,298 @@ nlohmann::json Conversation::toGeminiFormat() const {
     return j;
 }
 
+// The Gemini "contents" entry of one message; keys in the order nlohmann::json dumps them, so the bytes
+// match toGeminiFormat().dump()
+static void appendEntry(std::string &out, const Message &msg)
+{
+    out += "{\"parts\":[{\"text\":";
+    out += nlohmann::json(msg.content).dump();
+    out += msg.role == Role::user ? "}],\"role\":\"user\"}" : "}],\"role\":\"model\"}";
+}
+
+// Cache the token estimate and the serialized Gemini entry of a new message: O(message size)
+void Conversation::indexMessage(Message &msg) const
+{
+    msg.tokens = static_cast<uint32_t>(estimateTokens(msg.content));
+    if (spilledBytes + geminiContents.size() > 0)
+        geminiContents += ',';
+    contentOffsets.push_back(spilledBytes + geminiContents.size());
+    appendEntry(geminiContents, msg);
+}
+
+// Only called with nothing spilled: every entry is rebuilt in memory, and the limit spills the oldest again
+void Conversation::rebuildIndex() const
+{
+    geminiContents.clear();
+    contentOffsets.clear();
+    for (auto &msg : messages)
+        indexMessage(msg);
+    enforceMemoryLimit();
+}
+
+void Conversation::resetSpill() const
+{
+    spilledMessages = 0;
+    spilledPieces.clear();
+    spilledStarts.clear();
+    spilledBytes = 0;
+}
+
+// Move the oldest in-memory message text to the spill segment until the text held in memory is down to half
+// the limit, so the newer text is copied into a fresh arena only once per limit / 2 bytes added
+void Conversation::enforceMemoryLimit() const
+{
+    if (memoryLimit == 0 || arena.used() + geminiContents.size() <= memoryLimit)
+        return;
+
+    std::string error;
+    if (!spill)
+    {
+        auto segment = std::make_unique<SpillSegment>();
+        if (!segment->open(spillDir, error))
+        {
+            std::cerr << "Warning: " << error << "; keeping the whole conversation in memory.\n";
+            memoryLimit = 0;
+            return;
+        }
+        spill = std::move(segment);
+    }
+
+    ScopedTimer timer("conversation.spill");
+    const size_t entriesEnd = spilledBytes + geminiContents.size();
+    size_t resident = arena.used() + geminiContents.size();
+    size_t end = spilledMessages;
+    while (end < messages.size() && resident > memoryLimit / 2)
+    {
+        size_t entryEnd = end + 1 < contentOffsets.size() ? contentOffsets[end + 1] : entriesEnd;
+        resident -= std::min(resident, messages[end].content.size() + (entryEnd - contentOffsets[end]));
+        ++end;
+    }
+    // the comma before the first entry kept in memory stays with it
+    const size_t cut = end < contentOffsets.size() ? contentOffsets[end] - 1 : entriesEnd;
+
+    std::string batch;
+    for (size_t i = spilledMessages; i < end; ++i)
+        batch.append(messages[i].content.data(), messages[i].content.size());
+    const size_t textBytes = batch.size();
+    batch.append(geminiContents, 0, cut - spilledBytes);
+    const char *base = spill->append(batch, error);
+    if (!base)
+    {
+        std::cerr << "Warning: " << error << "; keeping the whole conversation in memory.\n";
+        memoryLimit = 0;
+        return;
+    }
+
+    const char *text = base;
+    for (size_t i = spilledMessages; i < end; ++i)
+    {
+        messages[i].content = std::string_view(text, messages[i].content.size());
+        text += messages[i].content.size();
+    }
+    if (cut > spilledBytes)
+    {
+        spilledPieces.emplace_back(base + textBytes, cut - spilledBytes);
+        spilledStarts.push_back(spilledBytes);
+    }
+    geminiContents = geminiContents.substr(cut - spilledBytes);
+    spilledBytes = cut;
+
+    // what stays in memory moves to a fresh arena, so the old chunks are released
+    StringArena kept;
+    for (size_t i = end; i < messages.size(); ++i)
+        messages[i].content = kept.store(messages[i].content);
+    arena = std::move(kept);
+
+    metrics().increment("spill.messages", end - spilledMessages);
+    metrics().increment("spill.bytes", batch.size());
+    spilledMessages = end;
+}
+
+void Conversation::appendContents(std::string &out, size_t from, size_t to) const
+{
+    if (from < spilledBytes)
+    {
+        size_t piece = static_cast<size_t>(std::upper_bound(spilledStarts.begin(), spilledStarts.end(), from) - spilledStarts.begin()) - 1;
+        for (; piece < spilledPieces.size() && from < to && from < spilledBytes; ++piece)
+        {
+            const size_t pieceEnd = spilledStarts[piece] + spilledPieces[piece].size();
+            const size_t take = std::min(to, pieceEnd) - from;
+            out.append(spilledPieces[piece].data() + (from - spilledStarts[piece]), take);
+            from += take;
+        }
+    }
+    if (from < to)
+        out.append(geminiContents, from - spilledBytes, to - from);
+}
+
+static const char PAYLOAD_PREFIX[] = "{\"contents\":[";
+static const char PAYLOAD_SUFFIX[] = "]}";
+
+std::string Conversation::toGeminiPayload() const
+{
+    faultIn();
+    std::string payload;
+    payload.reserve(sizeof(PAYLOAD_PREFIX) + spilledBytes + geminiContents.size() + sizeof(PAYLOAD_SUFFIX));
+    payload += PAYLOAD_PREFIX;
+    appendContents(payload, 0, spilledBytes + geminiContents.size());
+    payload += PAYLOAD_SUFFIX;
+    return payload;
+}
+
+// Each selected range is a single substring of the cached entries, so no message is re-serialized
+std::string Conversation::toGeminiPayload(const ContextSelection &selection) const
+{
+    std::string payload = PAYLOAD_PREFIX;
+    bool first = true;
+    if (!selection.summary.empty())
+    {
+        payload += "{\"parts\":[{\"text\":";
+        payload += nlohmann::json("Summary of the earlier conversation:\n" + selection.summary).dump();
+        payload += "}],\"role\":\"user\"}";
+        first = false;
+    }
+    auto addEntry = [&](size_t, const Message &msg)
+    {
+        if (!first)
+            payload += ',';
+        appendEntry(payload, msg);
+        first = false;
+    };
+    for (auto range : selection.ranges)
+    {
+        if (range.first >= range.second || range.second > size())
+            continue;
+        // entries are cached for resident messages only; older ones are serialized from their blocks
+        if (range.first < pagedOut)
+        {
+            forEachMessage(range.first, std::min(range.second, pagedOut), addEntry);
+            range.first = pagedOut;
+            if (range.first >= range.second)
+                continue;
+        }
+        size_t begin = range.first - pagedOut;
+        size_t end = range.second - pagedOut;
+        size_t from = contentOffsets[begin];
+        // entry end-1 stops right before the comma preceding entry end
+        size_t to = (end < contentOffsets.size()) ? contentOffsets[end] - 1 : spilledBytes + geminiContents.size();
+        if (!first)
+            payload += ',';
+        appendContents(payload, from, to);
+        first = false;
+    }
+    payload += PAYLOAD_SUFFIX;
+    return payload;
+}
+
+void Conversation::loadSavedIndex() const
+{
+    // a stale or missing index file leaves it empty, and it is rebuilt from the messages
+    if (!relevanceFile.empty())
+    {
+        relevance.load(relevanceFile, loadedGeneration, relevanceDocuments);
+        relevanceFile.clear();
+    }
+}
+
+const RelevanceIndex &Conversation::relevanceIndex() const
+{
+    loadSavedIndex();
+    // messages are only ever appended (clearing resets the index), so only the new ones need indexing;
+    // those still on disk are decoded for it, not loaded
+    forEachMessage(relevance.size(), size(), [this](size_t, const Message &msg)
+                   { relevance.add(msg.content); });
+    return relevance;
+}
+
+const std::string &Conversation::getSummary() const
+{
+    return summary;
+}
+
+size_t Conversation::summaryCoverage() const
+{
+    return summaryCovers;
+}
+
+// The summary is only stored in the snapshot, so force one on the next persist
+void Conversation::setSummary(const std::string &text, size_t covers)
+{
+    summary = text;
+    summaryCovers = std::min(covers, size());
+    journalValid = false;
+    ++journalResets;
+}
 
 // phase 4 - Command handling and conversation history printing
 void Conversation::printHistory() const
 {
-    if (messages.empty())
+    printHistory(0, size());
+}
+
+// output is collected and written in large pieces instead of one stream insertion per field
+static const size_t HISTORY_WRITE_BYTES = 1 << 20;
+
+void Conversation::printHistory(size_t from, size_t count, std::ostream &out, std::ostream &err) const
+{
+    const size_t total = size();
+    if (total == 0)
     {
-        std::cout << "No conversation history available.\n";
+        out << "No conversation history available.\n";
         return;
     }
-    std::cout << "Conversation History:\n";
-    for (const auto &msg : messages)
+    from = std::min(from, total);
+    const size_t to = from + std::min(count, total - from);
+
+    std::string buffer;
+    buffer.reserve(HISTORY_WRITE_BYTES + 4096);
+    buffer += "Conversation History (messages " + std::to_string(from) + "-" + std::to_string(to == from ? from : to - 1) +
+              " of " + std::to_string(total) + "):\n";
+    auto emit = [&](size_t index, const Message &msg)
+    {
+        buffer += '#';
+        buffer += std::to_string(index);
+        buffer += " [";
+        buffer += formatTimestamp(msg.timestamp);
+        buffer += "] ";
+        buffer += roleToString(msg.role);
+        buffer += ": ";
+        buffer.append(msg.content.data(), msg.content.size());
+        buffer += '\n';
+        if (buffer.size() >= HISTORY_WRITE_BYTES)
+        {
+            out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            buffer.clear();
+        }
+    };
+
+    // older pages are shown straight from the snapshot: paging through an archive does not load it into memory
+    try
     {
-        std::cout << "[" << msg.timestamp << "] " << msg.role << ": " << msg.content << "\n";
+        forEachMessage(from, to, emit);
     }
+    catch (const std::exception &e)
+    {
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        out.flush();
+        err << "Error reading earlier messages: " << e.what() << "\n";
+        return;
+    }
+
+    out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    out.flush();
 }
 
 void Conversation::exportToMarkdown(const std::string &FILENAME) const
 {
-    if (messages.empty())
+    if (empty())
     {
         std::cout << "No conversation history to export.\n";
         return;
     }
     try
     {
+        faultIn();
         std::ofstream out(FILENAME);
         if (!out)
         {
@@ -237,13 +849,10 @@ void Conversation::exportToMarkdown(const std::string &FILENAME) const
         out << "# Conversation History\n\n";
         for (const auto &msg : messages)
         {
-            std::string roleHeader =
-                (msg.role == "user" || msg.role == "User")
-                    ? "User"
-                    : "Gemini";
+            std::string roleHeader = (msg.role == Role::user) ? "User" : "Gemini";
 
             out << "## " << roleHeader << "\n";
-            out << "_[" << msg.timestamp << "]_\n\n";
+            out << "_[" << formatTimestamp(msg.timestamp) << "]_\n\n";
             out << msg.content << "\n\n";
         }
         out.close();
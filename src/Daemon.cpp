@@ -0,0 +1,876 @@
+#include "Daemon.h"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <streambuf>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "CLIHandler.h"
+#include "Metrics.h"
+
+// a longer frame means the peer is not speaking the protocol
+static const uint32_t MAX_FRAME_BYTES = 64u << 20;
+// command output is sent in frames of about this size
+static const size_t OUTPUT_FRAME_BYTES = 64 * 1024;
+
+// SIGINT/SIGTERM in the daemon, SIGINT (cancel the request) in a client
+static volatile std::sig_atomic_t g_signalled = 0;
+
+static void handleSignal(int)
+{
+    g_signalled = 1;
+}
+
+// Installed without SA_RESTART so poll() returns when the signal arrives
+static void installSignalHandler(int signal)
+{
+    struct sigaction action = {};
+    action.sa_handler = handleSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = 0;
+    sigaction(signal, &action, nullptr);
+}
+
+std::string defaultDaemonSocket()
+{
+    const char *envSocket = std::getenv("GEMINI_DAEMON_SOCKET");
+    return envSocket ? envSocket : "./data/daemon.sock";
+}
+
+static bool writeAll(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool readAll(int fd, char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = ::recv(fd, data, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool writeFrame(int fd, const nlohmann::json &message)
+{
+    // replies are not guaranteed to be valid UTF-8; never let one drop the connection
+    const std::string body = message.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+    const uint32_t size = static_cast<uint32_t>(body.size());
+    std::string frame;
+    frame.reserve(4 + body.size());
+    frame += static_cast<char>(size >> 24);
+    frame += static_cast<char>(size >> 16);
+    frame += static_cast<char>(size >> 8);
+    frame += static_cast<char>(size);
+    frame += body;
+    return writeAll(fd, frame.data(), frame.size());
+}
+
+bool readFrame(int fd, nlohmann::json &message)
+{
+    unsigned char header[4];
+    if (!readAll(fd, reinterpret_cast<char *>(header), sizeof(header)))
+        return false;
+    const uint32_t size = (static_cast<uint32_t>(header[0]) << 24) | (static_cast<uint32_t>(header[1]) << 16) |
+                          (static_cast<uint32_t>(header[2]) << 8) | header[3];
+    if (size > MAX_FRAME_BYTES)
+        return false;
+    std::string body(size, '\0');
+    if (!readAll(fd, body.data(), size))
+        return false;
+    message = nlohmann::json::parse(body, nullptr, false);
+    return message.is_object();
+}
+
+static std::string fieldOf(const nlohmann::json &message, const char *name)
+{
+    auto it = message.find(name);
+    return it != message.end() && it->is_string() ? it->get<std::string>() : std::string();
+}
+
+// Summary request for the messages a selection left out (store lock held); empty after a warning on err
+static std::string prepareSummary(Conversation &convo, size_t unsummarized, size_t &covers, std::ostream &err)
+{
+    try
+    {
+        covers = convo.summaryCoverage() + unsummarized;
+        return buildSummaryRequest(convo, convo.summaryCoverage(), covers);
+    }
+    catch (const std::exception &e)
+    {
+        err << "Warning: failed to update conversation summary: " << e.what() << "\n";
+        return std::string();
+    }
+}
+
+// The model's summary for a prepared request; false after a warning on err
+static bool requestSummary(GeminiClient &client, const std::string &request, std::string &summary, std::ostream &err)
+{
+    ScopedTimer summaryTimer("turn.summary");
+    try
+    {
+        summary = client.extractGeminiReply(client.sendPayload(request));
+        return true;
+    }
+    catch (const std::exception &e)
+    {
+        err << "Warning: failed to update conversation summary: " << e.what() << "\n";
+        return false;
+    }
+}
+
+void foldIntoSummary(GeminiClient &client, SessionStore &store, Conversation &convo, size_t unsummarized)
+{
+    std::string summaryRequest;
+    size_t covers = 0;
+    {
+        auto lock = store.lock();
+        summaryRequest = prepareSummary(convo, unsummarized, covers, std::cerr);
+    }
+    std::string summary;
+    if (summaryRequest.empty() || !requestSummary(client, summaryRequest, summary, std::cerr))
+        return;
+    auto lock = store.lock();
+    convo.setSummary(summary, covers);
+}
+
+// One attached client. Only the connection's own thread sends to it (streamed text goes through a ReplyRelay),
+// so a client that stops reading holds up nobody but itself.
+struct ClientConnection
+{
+    int fd;
+    // the session this client works in; prompts reach it by id, the store's current session follows it
+    // only while one of its commands runs
+    std::string sessionId;
+    bool open = true;
+
+    explicit ClientConnection(int fd) : fd(fd) {}
+
+    bool send(const nlohmann::json &message)
+    {
+        if (open && !writeFrame(fd, message))
+            open = false;
+        return open;
+    }
+};
+
+// Length of the longest prefix of text that does not end inside a UTF-8 sequence
+static size_t completeUtf8Prefix(const std::string &text)
+{
+    size_t lead = text.size();
+    while (lead > 0 && text.size() - lead < 3 && (static_cast<unsigned char>(text[lead - 1]) & 0xC0) == 0x80)
+        --lead;
+    if (lead == 0)
+        return text.size();
+    const unsigned char c = static_cast<unsigned char>(text[lead - 1]);
+    const size_t length = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+    return text.size() - (lead - 1) < length ? lead - 1 : text.size();
+}
+
+// Reply text as it streams in on the GeminiClient's worker, handed to the connection's own thread for sending.
+// The worker runs every client's transfers, so it must never block on a client that stopped reading.
+class ReplyRelay
+{
+private:
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::string text;
+    bool done = false;
+
+public:
+    void push(const std::string &chunk)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            text += chunk;
+        }
+        changed.notify_one();
+    }
+
+    void finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+        }
+        changed.notify_one();
+    }
+
+    // Wait up to timeout for more text or the end of the reply; returns the text that arrived
+    std::string wait(std::chrono::milliseconds timeout, bool &finished)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait_for(lock, timeout, [this] { return done || !text.empty(); });
+        finished = done;
+        std::string arrived;
+        arrived.swap(text);
+        return arrived;
+    }
+};
+
+// Output and error text of a line, sent to the client as "output" / "error" frames
+class FrameOutput : public std::streambuf
+{
+private:
+    ClientConnection &connection;
+    const char *type;
+    std::string pending;
+
+    void send(size_t size)
+    {
+        if (size == 0)
+            return;
+        connection.send({{"type", type}, {"text", pending.substr(0, size)}});
+        pending.erase(0, size);
+    }
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        if (c != traits_type::eof())
+            pending += traits_type::to_char_type(c);
+        if (pending.size() >= OUTPUT_FRAME_BYTES)
+            send(completeUtf8Prefix(pending));
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char *data, std::streamsize size) override
+    {
+        pending.append(data, static_cast<size_t>(size));
+        if (pending.size() >= OUTPUT_FRAME_BYTES)
+            send(completeUtf8Prefix(pending));
+        return size;
+    }
+
+    // flush() may come in the middle of a character; the tail waits for the next write
+    int sync() override
+    {
+        send(completeUtf8Prefix(pending));
+        return 0;
+    }
+
+public:
+    FrameOutput(ClientConnection &connection, const char *type) : connection(connection), type(type) {}
+
+    void finish()
+    {
+        send(pending.size());
+    }
+};
+
+// Input of a line (e.g. /clear's confirmation): each read asks the client for one line
+class FrameInput : public std::streambuf
+{
+private:
+    ClientConnection &connection;
+    FrameOutput &out;
+    FrameOutput &err;
+    std::string line;
+
+protected:
+    int_type underflow() override
+    {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+
+        // the question has to reach the client before the answer can
+        out.finish();
+        err.finish();
+        if (!connection.send({{"type", "input"}}))
+            return traits_type::eof();
+        nlohmann::json message;
+        do
+        {
+            if (!readFrame(connection.fd, message))
+                return traits_type::eof();
+        } while (fieldOf(message, "op") != "input");
+
+        line = fieldOf(message, "text") + "\n";
+        setg(line.data(), line.data(), line.data() + line.size());
+        return traits_type::to_int_type(*gptr());
+    }
+
+public:
+    FrameInput(ClientConnection &connection, FrameOutput &out, FrameOutput &err)
+        : connection(connection), out(out), err(err) {}
+};
+
+// The streams one line reads and writes. Nothing touches the process-wide std::cout / std::cerr / std::cin, so
+// text written by other threads (the writer thread, the client's warnings) stays in the daemon's own output.
+struct ClientStreams
+{
+    FrameOutput outFrames;
+    FrameOutput errFrames;
+    FrameInput inFrames;
+    std::ostream out;
+    std::ostream err;
+    std::istream in;
+
+    explicit ClientStreams(ClientConnection &connection)
+        : outFrames(connection, "output"), errFrames(connection, "error"), inFrames(connection, outFrames, errFrames),
+          out(&outFrames), err(&errFrames), in(&inFrames) {}
+
+    // Send what was written so far, before a frame that does not go through the streams
+    void flush()
+    {
+        outFrames.finish();
+        errFrames.finish();
+    }
+};
+
+class DaemonServer
+{
+private:
+    SessionStore &store;
+    GeminiClient &client;
+    const DaemonOptions &options;
+
+    // held while a line reads or changes the store (commands, adding messages, selecting context); released
+    // for requests to the model and while a client is asked for input, so other clients keep going
+    std::mutex engineMutex;
+
+    // one prompt per session at a time, from adding it to adding its reply; taken before the engine mutex
+    std::mutex turnsMutex;
+    std::map<std::string, std::unique_ptr<std::mutex>> sessionTurns;
+
+    std::mutex connectionsMutex;
+    std::condition_variable connectionsClosed;
+    std::set<int> connections;
+
+    // Make the client's session the store's current one, for the commands (engine mutex held)
+    void enterSession(ClientConnection &connection, std::ostream &err);
+    // Save failures of the writer thread, reported to whichever client runs next (engine mutex held)
+    void reportSaveErrors(std::ostream &err);
+    std::mutex &sessionTurn(const std::string &id);
+    // Wait for the reply, sending its text as it arrives; a cancel frame or a dropped connection aborts the request
+    void awaitReply(ClientConnection &connection, PendingReply &reply, ReplyRelay &relay);
+    // /clear's question, asked without the engine mutex; true when the session may be cleared
+    bool confirmClear(ClientConnection &connection, ClientStreams &io);
+    void runCommand(ClientConnection &connection, const std::string &line, ClientStreams &io, bool &exit);
+    void runPrompt(ClientConnection &connection, const std::string &input, ClientStreams &io);
+    void handleLine(ClientConnection &connection, const std::string &line, bool &exit);
+    void serve(int fd);
+
+public:
+    std::atomic<bool> stopping{false};
+
+    DaemonServer(SessionStore &store, GeminiClient &client, const DaemonOptions &options)
+        : store(store), client(client), options(options) {}
+
+    void accept(int fd);
+    // Close every connection and wait for their threads
+    void shutdown();
+};
+
+void DaemonServer::enterSession(ClientConnection &connection, std::ostream &err)
+{
+    if (store.currentInfo().id == connection.sessionId)
+        return;
+    if (!store.switchTo(connection.sessionId))
+    {
+        err << "Session " << connection.sessionId << " is no longer available; using "
+                  << store.currentInfo().id << ".\n";
+        connection.sessionId = store.currentInfo().id;
+    }
+}
+
+void DaemonServer::reportSaveErrors(std::ostream &err)
+{
+    for (const std::string &error : store.takeSaveErrors())
+        err << "ERROR: Failed to save chat history: " << error << "\n";
+}
+
+std::mutex &DaemonServer::sessionTurn(const std::string &id)
+{
+    std::lock_guard<std::mutex> lock(turnsMutex);
+    std::unique_ptr<std::mutex> &turn = sessionTurns[id];
+    if (!turn)
+        turn = std::make_unique<std::mutex>();
+    return *turn;
+}
+
+void DaemonServer::awaitReply(ClientConnection &connection, PendingReply &reply, ReplyRelay &relay)
+{
+    bool reading = true;
+    for (;;)
+    {
+        bool finished = false;
+        const std::string text = relay.wait(std::chrono::milliseconds(100), finished);
+        if (!text.empty())
+            connection.send({{"type", "chunk"}, {"text", text}});
+        if (finished)
+            break;
+        if (stopping)
+            reply.cancel();
+        if (!reading)
+            continue;
+
+        struct pollfd pfd = {connection.fd, POLLIN, 0};
+        if (poll(&pfd, 1, 0) <= 0)
+            continue;
+        nlohmann::json message;
+        if (!readFrame(connection.fd, message))
+        {
+            reading = false;
+            reply.cancel();
+        }
+        else if (fieldOf(message, "op") == "cancel")
+        {
+            reply.cancel();
+        }
+    }
+}
+
+bool DaemonServer::confirmClear(ClientConnection &connection, ClientStreams &io)
+{
+    {
+        std::lock_guard<std::mutex> engine(engineMutex);
+        Conversation &convo = store.session(connection.sessionId);
+        auto lock = store.lock();
+        if (convo.empty())
+            return true;
+    }
+    io.out << "Current conversation will be lost. Continue? (y/n): ";
+    std::string choice;
+    std::getline(io.in, choice);
+    if (choice == "y" || choice == "Y")
+        return true;
+    io.out << "Cancelled. Conversation preserved.\n";
+    return false;
+}
+
+void DaemonServer::runCommand(ClientConnection &connection, const std::string &line, ClientStreams &io, bool &exit)
+{
+    if (line == "/clear" && !confirmClear(connection, io))
+        return;
+
+    std::lock_guard<std::mutex> engine(engineMutex);
+    enterSession(connection, io.err);
+    reportSaveErrors(io.err);
+    if (line == "/shutdown")
+    {
+        io.out << "Daemon shutting down.\n";
+        stopping = true;
+        exit = true;
+        return;
+    }
+    if (line == "/clear")
+        clearSession(store, io.out);
+    else
+        handleCommand(line, store, exit, io.out, io.err, io.in);
+    connection.sessionId = store.currentInfo().id;
+}
+
+void DaemonServer::runPrompt(ClientConnection &connection, const std::string &input, ClientStreams &io)
+{
+    const auto started = std::chrono::steady_clock::now();
+    // a second client's prompt to the same session waits here, so the history stays user, model, user, model
+    std::lock_guard<std::mutex> turn(sessionTurn(connection.sessionId));
+
+    ContextSelection context;
+    std::string payload;
+    {
+        std::lock_guard<std::mutex> engine(engineMutex);
+        reportSaveErrors(io.err);
+        Conversation &convo = store.session(connection.sessionId);
+        metrics().increment("turns");
+        {
+            auto lock = store.lock();
+            convo.addMessage(Role::user, input);
+        }
+        if (!client.isConfigured())
+        {
+            io.err << "Gemini client unavailable (GEMINI_API_KEY not set); skipping request.\n";
+            store.markDirty(connection.sessionId);
+            return;
+        }
+
+        ScopedTimer selectTimer("turn.context");
+        auto lock = store.lock();
+        context = options.policy->select(convo, options.contextBudget);
+        selectTimer.stop();
+        ScopedTimer payloadTimer("turn.payload");
+        payload = convo.toGeminiPayload(context);
+    }
+    io.flush();
+
+    std::string reply;
+    bool replied = false;
+    try
+    {
+        connection.send({{"type", "output"}, {"text", "Gemini: "}});
+        ReplyRelay relay;
+        GeminiClient::ChunkCallback onChunk;
+        if (options.streamReplies)
+            onChunk = [&relay](const std::string &chunk) { relay.push(chunk); };
+        ScopedTimer waitTimer("turn.wait");
+        std::unique_ptr<PendingReply> pending = client.start(std::move(payload), onChunk, [&relay]() { relay.finish(); });
+        awaitReply(connection, *pending, relay);
+        reply = pending->get();
+        waitTimer.stop();
+        if (!options.streamReplies)
+            connection.send({{"type", "chunk"}, {"text", reply}});
+        connection.send({{"type", "output"}, {"text", "\n"}});
+        replied = true;
+    }
+    catch (const RequestCancelled &)
+    {
+        metrics().increment("turns.cancelled");
+        connection.send({{"type", "output"}, {"text", "\n[cancelled] The request was aborted; your message is kept in the history.\n"}});
+    }
+    catch (const std::exception &e)
+    {
+        metrics().increment("turns.failed");
+        connection.send({{"type", "error"}, {"text", std::string("\nError: ") + e.what() + "\n"}});
+    }
+
+    std::string summaryRequest;
+    size_t covers = 0;
+    {
+        // another client may have unloaded this session while the reply was awaited
+        std::lock_guard<std::mutex> engine(engineMutex);
+        Conversation &convo = store.session(connection.sessionId);
+        if (replied)
+        {
+            auto lock = store.lock();
+            convo.addMessage(Role::model, reply);
+            if (context.unsummarized > 0)
+                summaryRequest = prepareSummary(convo, context.unsummarized, covers, io.err);
+        }
+        store.markDirty(connection.sessionId);
+    }
+
+    // the summary is one more round trip to the model, made without the engine mutex like the reply
+    std::string summary;
+    if (!summaryRequest.empty() && requestSummary(client, summaryRequest, summary, io.err))
+    {
+        std::lock_guard<std::mutex> engine(engineMutex);
+        Conversation &convo = store.session(connection.sessionId);
+        bool folded = false;
+        {
+            auto lock = store.lock();
+            // a /clear from another client meanwhile leaves nothing to summarize
+            if (convo.summaryCoverage() < covers && covers <= convo.size())
+            {
+                convo.setSummary(summary, covers);
+                folded = true;
+            }
+        }
+        if (folded)
+            store.markDirty(connection.sessionId);
+    }
+    metrics().record("turn.total", elapsedMs(started));
+    if (!options.metricsFile.empty() && !metrics().writeToFile(options.metricsFile))
+        io.err << "Warning: failed to write metrics to " << options.metricsFile << "\n";
+}
+
+void DaemonServer::handleLine(ClientConnection &connection, const std::string &line, bool &exit)
+{
+    ClientStreams io(connection);
+    std::string input = line;
+    input.erase(0, input.find_first_not_of(" \t\n\r"));
+    input.erase(input.find_last_not_of(" \t\n\r") + 1);
+
+    // a throw here would end the connection's thread, and with it the daemon and every attached session
+    try
+    {
+        if (!input.empty() && input[0] == '/')
+            runCommand(connection, input, io, exit);
+        else if (input.empty())
+            io.err << "Please enter a message or command.\n";
+        else
+            runPrompt(connection, input, io);
+    }
+    catch (const std::exception &e)
+    {
+        io.err << "Error: " << e.what() << "\n";
+    }
+    io.flush();
+}
+
+void DaemonServer::serve(int fd)
+{
+    ClientConnection connection(fd);
+    {
+        std::lock_guard<std::mutex> engine(engineMutex);
+        connection.sessionId = store.currentInfo().id;
+    }
+    metrics().increment("daemon.clients");
+    connection.send({{"type", "output"},
+                     {"text", "Session: " + connection.sessionId +
+                                  " (daemon). Commands: /new, /sessions, /switch <id>, /load <file>, /export <file>, /help, /exit, /shutdown\n"}});
+    connection.send({{"type", "done"}, {"session", connection.sessionId}, {"exit", false}});
+
+    nlohmann::json message;
+    while (!stopping && readFrame(fd, message))
+    {
+        // a cancel that arrives after its reply finished has nothing left to cancel
+        if (fieldOf(message, "op") != "line")
+            continue;
+        bool exit = false;
+        handleLine(connection, fieldOf(message, "text"), exit);
+        if (!connection.send({{"type", "done"}, {"session", connection.sessionId}, {"exit", exit}}) || exit)
+            break;
+    }
+}
+
+void DaemonServer::accept(int fd)
+{
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        connections.insert(fd);
+    }
+    std::thread([this, fd]()
+                {
+        serve(fd);
+        // the last thing this thread touches: shutdown() may return as soon as the set is empty
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        connections.erase(fd);
+        ::close(fd);
+        connectionsClosed.notify_all(); })
+        .detach();
+}
+
+void DaemonServer::shutdown()
+{
+    stopping = true;
+    std::unique_lock<std::mutex> lock(connectionsMutex);
+    // wakes threads blocked reading their client; a turn in flight is cancelled by awaitReply
+    for (int fd : connections)
+        ::shutdown(fd, SHUT_RDWR);
+    connectionsClosed.wait(lock, [this] { return connections.empty(); });
+}
+
+static bool socketAddress(const std::string &path, sockaddr_un &address)
+{
+    address = {};
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "Error: socket path must be 1-" << sizeof(address.sun_path) - 1 << " characters: " << path << "\n";
+        return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+static int connectTo(const sockaddr_un &address)
+{
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && ::connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+int runDaemon(SessionStore &store, GeminiClient &client, const DaemonOptions &options)
+{
+    sockaddr_un address;
+    if (!socketAddress(options.socketPath, address))
+        return EXIT_FAILURE;
+
+    // a socket that accepts connections belongs to a running daemon; otherwise it is left over from a crash
+    int probe = connectTo(address);
+    if (probe >= 0)
+    {
+        ::close(probe);
+        std::cerr << "Error: a daemon is already listening on " << options.socketPath << "\n";
+        return EXIT_FAILURE;
+    }
+    ::unlink(options.socketPath.c_str());
+
+    int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    // only the owner may connect: clients act on the sessions with the daemon's API key
+    const mode_t savedMask = ::umask(077);
+    const bool bound = listener >= 0 && ::bind(listener, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0;
+    ::umask(savedMask);
+    if (!bound || ::listen(listener, 64) != 0)
+    {
+        std::cerr << "Error: cannot listen on " << options.socketPath << ": " << std::strerror(errno) << "\n";
+        if (listener >= 0)
+            ::close(listener);
+        return EXIT_FAILURE;
+    }
+
+    std::signal(SIGPIPE, SIG_IGN);
+    installSignalHandler(SIGINT);
+    installSignalHandler(SIGTERM);
+    std::cerr << "Daemon listening on " << options.socketPath << " (session " << store.currentInfo().id
+              << "); stop it with Ctrl-C, SIGTERM or /shutdown from a client.\n";
+
+    DaemonServer server(store, client, options);
+    while (!g_signalled && !server.stopping)
+    {
+        struct pollfd pfd = {listener, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0)
+            continue;
+        int fd = ::accept(listener, nullptr, nullptr);
+        if (fd >= 0)
+            server.accept(fd);
+    }
+
+    ::close(listener);
+    ::unlink(options.socketPath.c_str());
+    server.shutdown();
+    store.markDirty();
+    store.flush();
+    for (const std::string &error : store.takeSaveErrors())
+        std::cerr << "ERROR: Failed to save chat history: " << error << "\n";
+    std::cerr << "Daemon stopped.\n";
+    return EXIT_SUCCESS;
+}
+
+// Paths in /load and /export are resolved by the daemon, which may run in another directory
+static std::string resolvePaths(const std::string &line)
+{
+    std::istringstream iss(line);
+    std::string command, arg;
+    iss >> command >> std::ws;
+    std::getline(iss, arg);
+    if ((command != "/load" && command != "/export") || arg.empty())
+        return line;
+    std::error_code ec;
+    std::filesystem::path absolute = std::filesystem::absolute(arg, ec);
+    return ec ? line : command + " " + absolute.string();
+}
+
+// Print the daemon's frames until the line is done; false if the connection was lost
+static bool receiveUntilDone(int fd, bool interactive, bool &exit)
+{
+    // piped input is left for the prompt; only an interactive terminal is read for /cancel
+    bool stdinOpen = interactive;
+    for (;;)
+    {
+        struct pollfd fds[2] = {{fd, POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+        int ready = poll(fds, stdinOpen ? 2 : 1, 100);
+        if (g_signalled)
+        {
+            g_signalled = 0;
+            writeFrame(fd, {{"op", "cancel"}});
+        }
+        if (ready <= 0)
+            continue;
+
+        if (stdinOpen && (fds[1].revents & (POLLIN | POLLHUP)))
+        {
+            std::string line;
+            if (!std::getline(std::cin, line))
+            {
+                std::cin.clear();
+                stdinOpen = false;
+            }
+            else if (line.find("/cancel") != std::string::npos)
+            {
+                writeFrame(fd, {{"op", "cancel"}});
+            }
+            else
+            {
+                std::cerr << "A request is in progress; type /cancel or press Ctrl-C to abort it.\n";
+            }
+        }
+        if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+            continue;
+
+        nlohmann::json message;
+        if (!readFrame(fd, message))
+            return false;
+        const std::string type = fieldOf(message, "type");
+        if (type == "output" || type == "chunk")
+        {
+            std::cout << fieldOf(message, "text") << std::flush;
+        }
+        else if (type == "error")
+        {
+            std::cerr << fieldOf(message, "text");
+        }
+        else if (type == "input")
+        {
+            std::string answer;
+            if (!std::getline(std::cin, answer))
+                std::cin.clear();
+            writeFrame(fd, {{"op", "input"}, {"text", answer}});
+        }
+        else if (type == "done")
+        {
+            auto it = message.find("exit");
+            exit = it != message.end() && it->is_boolean() && it->get<bool>();
+            return true;
+        }
+    }
+}
+
+int runDaemonClient(const std::string &socketPath)
+{
+    sockaddr_un address;
+    if (!socketAddress(socketPath, address))
+        return EXIT_FAILURE;
+    int fd = connectTo(address);
+    if (fd < 0)
+    {
+        std::cerr << "Error: cannot connect to a daemon on " << socketPath << ": " << std::strerror(errno)
+                  << "\nStart one with: persistent_cli --daemon\n";
+        return EXIT_FAILURE;
+    }
+
+    std::signal(SIGPIPE, SIG_IGN);
+    installSignalHandler(SIGINT);
+    const bool interactive = isatty(STDIN_FILENO);
+
+    bool exit = false;
+    // the daemon greets with the session line
+    bool connected = receiveUntilDone(fd, interactive, exit);
+    std::string line;
+    while (connected && !exit)
+    {
+        std::cout << "\nYou: " << std::flush;
+        g_signalled = 0;
+        if (!std::getline(std::cin, line))
+        {
+            std::cout << "\n";
+            break;
+        }
+        connected = writeFrame(fd, {{"op", "line"}, {"text", resolvePaths(line)}}) && receiveUntilDone(fd, interactive, exit);
+    }
+    ::close(fd);
+    if (!connected)
+    {
+        std::cerr << "\nError: the connection to the daemon was lost.\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
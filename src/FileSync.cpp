@@ -0,0 +1,55 @@
+#include "FileSync.h"
+#include <cerrno>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+
+static bool syncPath(const std::string &path, int flags)
+{
+    int fd = ::open(path.c_str(), flags | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    int rc;
+    do
+    {
+        rc = ::fsync(fd);
+    } while (rc != 0 && errno == EINTR);
+    ::close(fd);
+    return rc == 0;
+}
+
+bool syncFile(const std::string &path)
+{
+    return syncPath(path, O_RDONLY);
+}
+
+bool syncParentDirectory(const std::string &path)
+{
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    return syncPath(parent.empty() ? "." : parent.string(), O_RDONLY | O_DIRECTORY);
+}
+
+bool replaceFile(const std::string &path, const std::string &contents)
+{
+    const std::string tempfile = path + ".tmp";
+    {
+        std::ofstream out(tempfile, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+        out.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+        out.close();
+        if (!out || !syncFile(tempfile))
+        {
+            std::remove(tempfile.c_str());
+            return false;
+        }
+    }
+    if (std::rename(tempfile.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tempfile.c_str());
+        return false;
+    }
+    return syncParentDirectory(path);
+}
@@ -8,18 +8,448 @@
 #include <cstring>
 #include <algorithm>
 #include <cctype>
+#include <climits>
+#include <cmath>
+#include "Metrics.h"
+#include "Gzip.h"
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <vector>
 
-static size_t writeCallback(
-    void *contents,
-    size_t size,
-    size_t nmemb,
-    void *userp)
+// State for one streaming request: raw bytes are split into SSE events inside the write callback
+struct StreamState
 {
-    size_t total = size * nmemb;
-    std::string *str = static_cast<std::string *>(userp);
-    str->append(static_cast<char *>(contents), total);
-    return total;
+    GeminiClient::ChunkCallback onChunk;
+    std::string pending; // bytes of an incomplete line
+    std::string data;    // data: lines of the current event
+    std::string text;    // reply assembled so far
+    std::string raw;     // non-SSE body (API errors are returned as plain JSON)
+    std::string error;
+    size_t events = 0;
+    std::chrono::steady_clock::time_point submitted;
+};
+
+namespace
+{
+    // What a GenerateContentResponse carries for us
+    struct ReplyText
+    {
+        std::string text;     // candidates[0].content.parts[].text, concatenated
+        bool candidate = false;
+        size_t textParts = 0;
+        bool error = false;   // top-level "error" object: parse the (small) body again for the details
+        std::string parseError;
+    };
+
+    // SAX handler following only candidates[0].content.parts[].text; the rest of the document is
+    // tokenized and dropped without building a DOM.
+    class ReplySaxHandler : public nlohmann::json_sax<nlohmann::json>
+    {
+    public:
+        explicit ReplySaxHandler(ReplyText &out) : out(out) {}
+
+        bool null() override { return scalar(); }
+        bool boolean(bool) override { return scalar(); }
+        bool number_integer(number_integer_t) override { return scalar(); }
+        bool number_unsigned(number_unsigned_t) override { return scalar(); }
+        bool number_float(number_float_t, const string_t &) override { return scalar(); }
+        bool binary(binary_t &) override { return scalar(); }
+
+        bool string(string_t &value) override
+        {
+            if (frames.size() == PATH_LENGTH && childOnPath())
+            {
+                // a single-part reply is moved, not copied
+                if (out.text.empty())
+                    out.text = std::move(value);
+                else
+                    out.text += value;
+                ++out.textParts;
+            }
+            return scalar();
+        }
+
+        bool start_object(std::size_t) override
+        {
+            bool onPath = childOnPath();
+            if (onPath && frames.size() == 2)
+                out.candidate = true;
+            frames.push_back({false, onPath});
+            return true;
+        }
+
+        bool start_array(std::size_t) override
+        {
+            frames.push_back({true, childOnPath()});
+            return true;
+        }
+
+        bool end_object() override { return endContainer(); }
+        bool end_array() override { return endContainer(); }
+
+        bool key(string_t &name) override
+        {
+            Frame &top = frames.back();
+            size_t level = frames.size() - 1;
+            top.keyMatches = top.onPath && level < PATH_LENGTH && PATH[level] && name == PATH[level];
+            if (level == 0 && name == "error")
+                out.error = true;
+            return true;
+        }
+
+        bool parse_error(std::size_t, const std::string &, const nlohmann::detail::exception &e) override
+        {
+            out.parseError = e.what();
+            return false;
+        }
+
+    private:
+        // object keys along the path; nullptr marks an array level (candidates: first element, parts: all)
+        static constexpr const char *PATH[] = {"candidates", nullptr, "content", "parts", nullptr, "text"};
+        static constexpr size_t PATH_LENGTH = sizeof(PATH) / sizeof(PATH[0]);
+
+        struct Frame
+        {
+            bool array;
+            bool onPath;
+            size_t index = 0;
+            bool keyMatches = false;
+        };
+
+        ReplyText &out;
+        std::vector<Frame> frames;
+
+        // Whether the value starting now lies on the path
+        bool childOnPath() const
+        {
+            if (frames.empty())
+                return true;
+            const Frame &top = frames.back();
+            if (!top.onPath)
+                return false;
+            if (!top.array)
+                return top.keyMatches;
+            // level 1 is the candidates array, level 4 the parts array
+            return frames.size() - 1 == 4 || top.index == 0;
+        }
+
+        bool scalar()
+        {
+            if (!frames.empty() && frames.back().array)
+                ++frames.back().index;
+            return true;
+        }
+
+        bool endContainer()
+        {
+            frames.pop_back();
+            return scalar();
+        }
+    };
+
+    // false if the text is not valid JSON
+    bool extractReplyText(const std::string &json, ReplyText &out)
+    {
+        ReplySaxHandler handler(out);
+        return nlohmann::json::sax_parse(json, &handler);
+    }
+}
+
+// Dispatch one complete SSE event; returns false to abort the transfer
+static bool handleEvent(StreamState &state)
+{
+    if (state.data.empty())
+        return true;
+
+    ReplyText reply;
+    bool parsed = extractReplyText(state.data, reply);
+    if (!parsed)
+    {
+        state.data.clear();
+        state.error = "Malformed event in Gemini stream";
+        return false;
+    }
+    ++state.events;
+
+    if (reply.error)
+    {
+        // let extractGeminiReply produce the usual error message
+        state.raw = std::move(state.data);
+        state.data.clear();
+        state.error = "error";
+        return false;
+    }
+    state.data.clear();
+
+    const std::string &piece = reply.text;
+    if (piece.empty())
+        return true;
+    if (state.text.empty())
+        metrics().record("reply.first_chunk", elapsedMs(state.submitted));
+    state.text += piece;
+    try
+    {
+        state.onChunk(piece);
+    }
+    catch (const std::exception &e)
+    {
+        state.error = e.what();
+        return false;
+    }
+    return true;
+}
+
+// Split received bytes into SSE lines/events; returns false to abort the transfer
+static bool feedStream(StreamState *state, const char *contents, size_t total)
+{
+    state->pending.append(contents, total);
+
+    size_t start = 0;
+    size_t newline;
+    while ((newline = state->pending.find('\n', start)) != std::string::npos)
+    {
+        size_t end = newline;
+        if (end > start && state->pending[end - 1] == '\r')
+            --end;
+        std::string_view line(state->pending.data() + start, end - start);
+        start = newline + 1;
+
+        if (line.empty())
+        {
+            // blank line terminates the event
+            if (!handleEvent(*state))
+                return false;
+        }
+        else if (line.rfind("data:", 0) == 0)
+        {
+            line.remove_prefix(5);
+            if (!line.empty() && line[0] == ' ')
+                line.remove_prefix(1);
+            if (!state->data.empty())
+                state->data += '\n';
+            state->data.append(line.data(), line.size());
+        }
+        else if (line[0] != ':' && line.rfind("event:", 0) != 0 && line.rfind("id:", 0) != 0 && line.rfind("retry:", 0) != 0)
+        {
+            // not SSE at all: an error body, keep it for extractGeminiReply
+            state->raw.append(line.data(), line.size());
+            state->raw += '\n';
+        }
+    }
+    state->pending.erase(0, start);
+    return true;
+}
+
+// One logical request: the attempt in flight plus what survives between retries
+struct ReplyState
+{
+    std::string payload;
+    std::string gzipped; // encoded payload, empty when it is sent as is
+    bool plainRetry = false;
+    std::shared_ptr<StreamState> stream;
+    std::function<void()> onDone;
+    std::string cacheKey; // empty when the cache is off
+    std::optional<std::string> cached; // answered from the cache: no transfer was made
+
+    mutable std::mutex mutex;
+    mutable std::condition_variable finished;
+    std::shared_ptr<HttpTransfer> transfer;
+    // every transfer gets its own serial, which its callbacks use to tell whether they still count
+    unsigned serial = 0;
+    unsigned serials = 0;
+    // first byte of the attempt that won, in ms from its start (negative until then)
+    double firstByteMs = -1;
+    // duplicate of the attempt in flight until one of the two receives a byte or finishes
+    std::shared_ptr<HttpTransfer> hedge;
+    std::shared_ptr<StreamState> hedgeStream;
+    unsigned hedgeSerial = 0;
+    std::chrono::steady_clock::time_point hedgeAt;
+    // transfers that lost a race, by serial, until their cancellation completes. A retry's race can be decided
+    // before an earlier loser is done, so each completion looks up its own.
+    std::vector<std::pair<unsigned, std::shared_ptr<HttpTransfer>>> losers;
+    // retries and hedges included, the request ends by then
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    bool deadlineExceeded = false;
+    int retries = 0;
+    bool cancelled = false;
+    bool complete = false;
+};
+
+// The first of an attempt and its hedge to receive a byte or to finish is kept and the other is cancelled.
+// Returns false for a transfer that no longer counts. Called with state.mutex held.
+static bool claimRace(ReplyState &state, unsigned serial)
+{
+    if (serial != state.serial && (!state.hedge || serial != state.hedgeSerial))
+        return false;
+    if (!state.hedge)
+        return true;
+
+    if (std::chrono::steady_clock::now() >= state.hedgeAt)
+        metrics().increment("hedge.fired");
+    if (serial == state.hedgeSerial)
+    {
+        std::swap(state.transfer, state.hedge);
+        std::swap(state.stream, state.hedgeStream);
+        std::swap(state.serial, state.hedgeSerial);
+        metrics().increment("hedge.won");
+    }
+    // a hedge still waiting for its delay is dropped before it reaches the network
+    state.hedge->cancel();
+    state.losers.emplace_back(state.hedgeSerial, std::move(state.hedge));
+    state.hedgeStream.reset();
+    return true;
+}
+
+void PendingReply::cancel()
+{
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->cancelled = true;
+    if (state->transfer)
+        state->transfer->cancel();
+    if (state->hedge)
+        state->hedge->cancel();
+}
+
+bool PendingReply::waitFor(std::chrono::milliseconds timeout) const
+{
+    std::unique_lock<std::mutex> lock(state->mutex);
+    return state->finished.wait_for(lock, timeout, [this] { return state->complete; });
+}
+
+size_t PendingReply::bytesReceived() const
+{
+    std::lock_guard<std::mutex> lock(state->mutex);
+    return state->transfer ? state->transfer->bytesReceived() : 0;
+}
+
+int PendingReply::retries() const
+{
+    std::lock_guard<std::mutex> lock(state->mutex);
+    return state->retries;
+}
+
+const HttpResult &PendingReply::finalResult() const
+{
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [this] { return state->complete; });
+    return state->transfer->result();
+}
+
+// Record curl's phase timings for one finished transfer. The uncompressed sizes are the JSON that was sent
+// and the decoded reply, next to the wire bytes curl counts.
+static void recordTransfer(const HttpResult &result, size_t requestBytes, size_t responseBytes)
+{
+    MetricsRegistry &registry = metrics();
+    const HttpTimings &t = result.timings;
+    registry.increment("http.requests");
+    if (result.cancelled)
+    {
+        registry.increment("http.cancelled");
+        return;
+    }
+    if (result.code != CURLE_OK || result.status >= 400)
+        registry.increment("http.errors");
+
+    // DNS, TCP and TLS only cost something when a new connection was opened
+    if (t.newConnections > 0)
+    {
+        registry.increment("http.connections_opened", t.newConnections);
+        registry.record("http.dns", t.nameLookup / 1000.0);
+        if (t.connect > 0)
+            registry.record("http.connect", (t.connect - t.nameLookup) / 1000.0);
+        if (t.appConnect > 0)
+            registry.record("http.tls", (t.appConnect - t.connect) / 1000.0);
+    }
+    else
+    {
+        registry.increment("http.connections_reused");
+    }
+    if (t.startTransfer > 0)
+    {
+        registry.record("http.ttfb", (t.startTransfer - t.preTransfer) / 1000.0);
+        registry.record("http.transfer", (t.total - t.startTransfer) / 1000.0);
+    }
+    registry.record("http.total", t.total / 1000.0);
+    registry.increment("http.bytes_sent", t.bytesUploaded);
+    registry.increment("http.bytes_sent_uncompressed", requestBytes);
+    registry.increment("http.bytes_received", t.bytesDownloaded);
+    registry.increment("http.bytes_received_uncompressed", responseBytes);
+}
+
+std::string PendingReply::get()
+{
+    if (state->cached)
+        return *state->cached;
+
+    const HttpResult &result = finalResult();
+    if (result.cancelled)
+    {
+        throw RequestCancelled();
+    }
+    if (state->deadlineExceeded)
+    {
+        throw std::runtime_error("No reply within the turn deadline (" + std::to_string(client->turnDeadlineMs) + " ms)");
+    }
+
+    if (!state->stream)
+    {
+        if (result.code != CURLE_OK)
+        {
+            throw std::runtime_error(std::string("CURL request failed: ") + curl_easy_strerror(result.code));
+        }
+        ScopedTimer parse("reply.parse");
+        std::string text = client->extractGeminiReply(result.body);
+        parse.stop();
+        client->cacheReply(*state, text);
+        return text;
+    }
+
+    // a stream may end without the trailing blank line
+    StreamState &stream = *state->stream;
+    if (result.code == CURLE_OK && stream.error.empty())
+    {
+        if (!stream.pending.empty())
+            feedStream(&stream, "\n\n", 2);
+        else if (!stream.data.empty())
+            handleEvent(stream);
+    }
+
+    if (!stream.raw.empty())
+    {
+        // throws the API error (429, 400, ...) with the same wording as the non-streaming path
+        client->extractGeminiReply(stream.raw);
+    }
+    if (!stream.error.empty())
+    {
+        throw std::runtime_error("Streaming request failed: " + stream.error);
+    }
+    if (result.code != CURLE_OK)
+    {
+        throw std::runtime_error(std::string("CURL request failed: ") + curl_easy_strerror(result.code));
+    }
+    if (stream.events == 0)
+    {
+        throw std::runtime_error("No candidates in Gemini response");
+    }
+    client->cacheReply(*state, stream.text);
+    return stream.text;
+}
+
+// smaller request bodies are sent as is: a few hundred bytes do not pay for the deflate call
+static const size_t GZIP_MIN_BYTES = 1024;
+// first-byte samples needed before their percentile is trusted; nothing is hedged until then
+static const size_t HEDGE_MIN_SAMPLES = 20;
+// the hedge delay is the percentile of this many most recent samples
+static const size_t HEDGE_WINDOW = 256;
+
+// Integer setting from the environment: durations in ms, counts, levels, sizes
+static long envLong(const char *name, long fallback)
+{
+    const char *value = std::getenv(name);
+    return value ? std::strtol(value, nullptr, 10) : fallback;
 }
+
 // api key
 GeminiClient::GeminiClient()
 {
@@ -35,123 +465,541 @@ GeminiClient::GeminiClient()
         apiKey = env_api_key;
     }
     // std::cout<<apiKey<<"\n";
-}
 
-std::string GeminiClient::sendMessage(const nlohmann::json &conversation) const
-{
-    // initialize curl
-    CURL *curl = curl_easy_init();
-    if (!curl)
+    const char *env_base = std::getenv("GEMINI_BASE_URL");
+    baseUrl = env_base ? env_base : "https://generativelanguage.googleapis.com/v1beta";
+    const char *env_model = std::getenv("GEMINI_MODEL");
+    model = env_model ? env_model : "gemini-2.5-flash";
+
+    // deadlines in milliseconds, 0 disables
+    connectTimeoutMs = envLong("GEMINI_CONNECT_TIMEOUT_MS", 10000);
+    timeoutMs = envLong("GEMINI_TIMEOUT_MS", 300000);
+
+    // client-side pacing matching the quota (0 = unlimited); the burst defaults to ten seconds' worth
+    const long rpm = envLong("GEMINI_RATE_LIMIT_RPM", 0);
+    if (rpm > 0)
     {
-        throw std::runtime_error("Failed to initialize CURL");
+        const long burst = envLong("GEMINI_RATE_LIMIT_BURST", std::max(1L, rpm / 6));
+        bucket.configure(rpm / 60.0, static_cast<double>(burst));
     }
-    // RAII wrappers for cleanup
-    struct CurlHandle {
-        CURL* c;
-        explicit CurlHandle(CURL* c):c(c){}
-        ~CurlHandle(){ if(c) curl_easy_cleanup(c); }
-    } guardCurl(curl);
+    maxRetries = static_cast<int>(std::clamp(envLong("GEMINI_MAX_RETRIES", 3), 0L, static_cast<long>(INT_MAX)));
+    retryBase = std::chrono::milliseconds(envLong("GEMINI_RETRY_BASE_MS", 1000));
+    retryMax = std::chrono::milliseconds(envLong("GEMINI_RETRY_MAX_MS", 60000));
+    gzipLevel = static_cast<int>(std::clamp(envLong("GEMINI_GZIP_LEVEL", 6), 0L, 9L));
+    gzipRequests = gzipLevel > 0 && gzipAvailable();
 
-    std::string response;
+    // tail latency: a deadline for the whole turn and hedged attempts, both off by default
+    turnDeadlineMs = std::max(0L, envLong("GEMINI_TURN_DEADLINE_MS", 0));
+    if (const char *env_hedge = std::getenv("GEMINI_HEDGE_PERCENTILE"))
+        hedgePercentile = std::clamp(std::strtod(env_hedge, nullptr), 0.0, 100.0);
+    hedgeMinDelay = std::chrono::milliseconds(std::max(0L, envLong("GEMINI_HEDGE_MIN_MS", 50)));
 
-    // ensure API key presentloadEnvFile(".env");
-    if (apiKey.empty()) {
+    // URL and headers are built once and shared by every request
+    url = baseUrl + "/models/" + model + ":generateContent?key=" + apiKey;
+    streamUrl = baseUrl + "/models/" + model + ":streamGenerateContent?alt=sse&key=" + apiKey;
+    headers = curl_slist_append(headers, "Content-Type: application/json");
+    gzipHeaders = curl_slist_append(gzipHeaders, "Content-Type: application/json");
+    gzipHeaders = curl_slist_append(gzipHeaders, "Content-Encoding: gzip");
+
+    const char *env_cache = std::getenv("GEMINI_CACHE");
+    const std::string cacheMode = env_cache ? env_cache : "off";
+    replayOnly = cacheMode == "replay";
+    if (cacheMode == "on" || replayOnly)
+    {
+        const char *env_cache_dir = std::getenv("GEMINI_CACHE_DIR");
+        const uint64_t maxBytes = static_cast<uint64_t>(std::max(1L, envLong("GEMINI_CACHE_MAX_MB", 256))) << 20;
+        cache = std::make_unique<ResponseCache>(env_cache_dir ? env_cache_dir : "./data/response_cache", maxBytes);
+        std::string error;
+        if (!cache->open(error))
+        {
+            std::cerr << "Warning: response cache disabled: " << error << "\n";
+            cache.reset();
+        }
+    }
+    else if (cacheMode != "off")
+    {
+        std::cerr << "Warning: unknown GEMINI_CACHE mode '" << cacheMode << "' (expected off, on or replay)\n";
+    }
+}
+
+GeminiClient::~GeminiClient()
+{
+    // stop the worker before the header list it may still be using goes away
+    engine.reset();
+    if (headers)
+        curl_slist_free_all(headers);
+    if (gzipHeaders)
+        curl_slist_free_all(gzipHeaders);
+}
+
+std::unique_ptr<PendingReply> GeminiClient::start(std::string payload, ChunkCallback onChunk, std::function<void()> onDone)
+{
+    // ensure API key present
+    if (apiKey.empty() && !replayOnly) {
         throw std::runtime_error("GEMINI_API_KEY is not configured; cannot send requests");
     }
 
-    // set url
-    std::string url = "https://generativelanguage.googleapis.com/v1beta/models/gemini-2.5-flash:generateContent?key=" + apiKey;
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    auto reply = std::unique_ptr<PendingReply>(new PendingReply());
+    reply->client = this;
+    reply->state = std::make_shared<ReplyState>();
+    reply->state->payload = std::move(payload);
+    reply->state->onDone = std::move(onDone);
+    if (turnDeadlineMs > 0)
+        reply->state->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(turnDeadlineMs);
+
+    // the same history under the same model was answered before: finish right here
+    if (cache)
+    {
+        reply->state->cacheKey = ResponseCache::key(model, reply->state->payload);
+        std::string text;
+        if (cache->lookup(reply->state->cacheKey, text))
+        {
+            if (onChunk)
+                onChunk(text);
+            reply->state->cached = std::move(text);
+            reply->state->complete = true;
+            if (reply->state->onDone)
+                reply->state->onDone();
+            return reply;
+        }
+    }
+    if (replayOnly) {
+        throw std::runtime_error("Replay mode: no cached reply for this request (key " +
+                                 (cache ? reply->state->cacheKey.substr(0, 16) : std::string("unavailable")) + ")");
+    }
+    // the history is resent every turn: compress once here, every attempt reuses the encoded body
+    if (gzipRequests && reply->state->payload.size() >= GZIP_MIN_BYTES)
+    {
+        ScopedTimer timer("request.gzip");
+        if (!gzipCompress(reply->state->payload, reply->state->gzipped, gzipLevel))
+            reply->state->gzipped.clear();
+    }
+    if (onChunk)
+    {
+        reply->state->stream = std::make_shared<StreamState>();
+        reply->state->stream->onChunk = std::move(onChunk);
+        reply->state->stream->submitted = std::chrono::steady_clock::now();
+    }
+
+    submitAttempt(reply->state, std::chrono::milliseconds(0));
+    return reply;
+}
 
-    // set headers
-    struct curl_slist *header = nullptr;
-    header = curl_slist_append(header, "Content-Type: application/json");
-    
-    // std::string authHeader = "Authorization: Bearer " + apiKey;
-    // header = curl_slist_append(header, authHeader.c_str());
+void GeminiClient::submitAttempt(const std::shared_ptr<ReplyState>& state, std::chrono::milliseconds delay)
+{
+    if (state->stream)
+    {
+        // a retried stream starts over (only streams that have not shown any text are retried)
+        StreamState &stream = *state->stream;
+        stream.pending.clear();
+        stream.data.clear();
+        stream.raw.clear();
+        stream.error.clear();
+        stream.events = 0;
+    }
 
-    // RAII for header
-    struct SlistGuard {
-        struct curl_slist* l;
-        explicit SlistGuard(struct curl_slist* l):l(l){}
-        ~SlistGuard(){ if(l) curl_slist_free_all(l); }
-    } guardHeader(header);
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, header);
+    // queued behind the rate limit; the worker starts it when due
+    const auto now = std::chrono::steady_clock::now();
+    const auto notBefore = std::max(now + delay, bucket.reserve());
+    if (notBefore > now)
+        metrics().record("request.delay", std::chrono::duration<double, std::milli>(notBefore - now).count());
+    const std::chrono::milliseconds hedgeAfter = hedgeDelay(state->stream != nullptr);
 
-    // set post data
-    std::string payload = conversation.dump();
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload.c_str());
+    // held across submit so the completion callback never sees the previous attempt
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->serial = ++state->serials;
+    state->firstByteMs = -1;
+    state->transfer = engine->submit(makeRequest(state, state->stream, state->serial, notBefore));
 
-    // callback function
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+    // the worker holds the hedge back until the delay has passed, so an attempt that answers in time
+    // cancels it before it is sent. Hedges do not take a rate limit slot: most of them are never sent.
+    if (hedgeAfter.count() >= 0 && notBefore + hedgeAfter < state->deadline)
+    {
+        std::shared_ptr<StreamState> hedgeStream;
+        if (state->stream)
+        {
+            hedgeStream = std::make_shared<StreamState>();
+            hedgeStream->onChunk = state->stream->onChunk;
+            hedgeStream->submitted = state->stream->submitted;
+        }
+        state->hedgeSerial = ++state->serials;
+        state->hedgeAt = notBefore + hedgeAfter;
+        HttpRequest hedge = makeRequest(state, hedgeStream, state->hedgeSerial, state->hedgeAt);
+        // a slow connection (or HTTP/2 connection) is what the hedge tries to get around
+        hedge.freshConnection = true;
+        state->hedgeStream = std::move(hedgeStream);
+        state->hedge = engine->submit(std::move(hedge));
+    }
+    if (state->cancelled)
+    {
+        state->transfer->cancel();
+        if (state->hedge)
+            state->hedge->cancel();
+    }
+}
 
-    // set timeout
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 0L);
+HttpRequest GeminiClient::makeRequest(const std::shared_ptr<ReplyState>& state, const std::shared_ptr<StreamState>& stream,
+                                      unsigned serial, std::chrono::steady_clock::time_point notBefore)
+{
+    HttpRequest request;
+    const bool gzipped = !state->gzipped.empty();
+    request.body = gzipped ? state->gzipped : state->payload;
+    request.headers = gzipped ? gzipHeaders : headers;
+    request.connectTimeoutMs = connectTimeoutMs;
+    request.timeoutMs = timeoutMs;
+    request.notBefore = notBefore;
+    if (state->deadline != std::chrono::steady_clock::time_point::max())
+    {
+        // rounded up, so an attempt that times out here has reached the turn deadline
+        const long left = std::max<long>(1, std::chrono::ceil<std::chrono::milliseconds>(state->deadline - notBefore).count());
+        request.timeoutMs = timeoutMs > 0 ? std::min(timeoutMs, left) : left;
+    }
 
-    // perform request
-    CURLcode res = curl_easy_perform(curl);
-    if (res != CURLE_OK)
+    if (stream)
+    {
+        request.url = streamUrl;
+        request.onData = [stream](const char *data, size_t size)
+        { return feedStream(stream.get(), data, size); };
+    }
+    else
     {
-        throw std::runtime_error(std::string("CURL request failed: ") + curl_easy_strerror(res));
+        request.url = url;
     }
 
-    // success: guards will clean up
-    return response;
+    request.onFirstByte = [state, serial, notBefore]()
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (claimRace(*state, serial))
+            state->firstByteMs = elapsedMs(notBefore);
+    };
+    request.onComplete = [this, state, serial]() { attemptFinished(state, serial); };
+    return request;
 }
 
+std::chrono::milliseconds GeminiClient::hedgeDelay(bool stream) const
+{
+    const std::chrono::milliseconds off(-1);
+    if (hedgePercentile <= 0)
+        return off;
+    std::vector<double> samples;
+    {
+        std::lock_guard<std::mutex> lock(firstByteMutex);
+        samples = firstByte[stream ? 1 : 0].ms;
+    }
+    if (samples.size() < HEDGE_MIN_SAMPLES)
+        return off;
 
-// Extract the assistant's reply from the Gemini API response
-std::string GeminiClient::extractGeminiReply(const std::string& responseStr) const {
-    try {
-        auto json = nlohmann::json::parse(responseStr);
-
-        // Check for API error response first
-        if (json.contains("error")) {
-            const auto& error = json["error"];
-            int code = error.value("code", 0);
-            std::string message = error.value("message", "Unknown error");
-            std::string status = error.value("status", "UNKNOWN");
-
-            // Handle rate limiting (429)
-            if (code == 429 || status == "RESOURCE_EXHAUSTED") {
-                std::string detail = "API Rate Limit Exceeded (Free Tier: 20 requests/day per model)\n";
-                detail += "Message: " + message + "\n";
-                
-                // Extract retry information if available
-                if (error.contains("details")) {
-                    for (const auto& detail_item : error["details"]) {
-                        if (detail_item.contains("retryDelay")) {
-                            detail += "Retry after: " + detail_item["retryDelay"].get<std::string>();
-                        }
-                    }
-                }
-                throw std::runtime_error(detail);
+    // nearest rank: the smallest sample with at least that share of the samples at or below it
+    size_t rank = static_cast<size_t>(std::ceil(hedgePercentile / 100.0 * samples.size()));
+    auto nth = samples.begin() + (std::clamp<size_t>(rank, 1, samples.size()) - 1);
+    std::nth_element(samples.begin(), nth, samples.end());
+    const auto delay = std::chrono::milliseconds(static_cast<long>(std::ceil(*nth)));
+    return std::max(delay, hedgeMinDelay);
+}
+
+void GeminiClient::attemptFinished(const std::shared_ptr<ReplyState>& state, unsigned serial)
+{
+    std::shared_ptr<HttpTransfer> transfer;
+    bool cancelled;
+    bool lost;
+    double firstByteMs;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        lost = !claimRace(*state, serial);
+        if (lost)
+        {
+            auto loser = std::find_if(state->losers.begin(), state->losers.end(),
+                                      [serial](const auto &entry) { return entry.first == serial; });
+            if (loser != state->losers.end())
+            {
+                transfer = std::move(loser->second);
+                state->losers.erase(loser);
             }
+        }
+        else
+        {
+            transfer = state->transfer;
+        }
+        cancelled = state->cancelled;
+        firstByteMs = state->firstByteMs;
+    }
+    if (lost)
+    {
+        // the other one of a hedged pair answered first; one dropped before it started never reached the network
+        if (transfer && transfer->result().timings.total > 0)
+            recordTransfer(transfer->result(), state->payload.size(), transfer->bytesReceived());
+        return;
+    }
+    const HttpResult &result = transfer->result();
+    recordTransfer(result, state->payload.size(), transfer->bytesReceived());
 
-            // Generic API error
-            std::string errorMsg = "Gemini API Error (Code " + std::to_string(code) + "): " + message;
-            throw std::runtime_error(errorMsg);
+    // successful attempts feed the percentile the hedge delay is taken from
+    if (firstByteMs >= 0 && result.code == CURLE_OK && result.status > 0 && result.status < 400)
+    {
+        std::lock_guard<std::mutex> lock(firstByteMutex);
+        FirstByteSamples &samples = firstByte[state->stream ? 1 : 0];
+        if (samples.ms.size() < HEDGE_WINDOW)
+            samples.ms.push_back(firstByteMs);
+        else
+            samples.ms[samples.next] = firstByteMs;
+        samples.next = (samples.next + 1) % HEDGE_WINDOW;
+    }
+    if (result.code == CURLE_OPERATION_TIMEDOUT && std::chrono::steady_clock::now() >= state->deadline)
+    {
+        state->deadlineExceeded = true;
+        metrics().increment("request.deadline_exceeded");
+    }
+
+    // the endpoint turned the gzip body down: send the same request as plain JSON, which is not a retry
+    if (!cancelled && !state->gzipped.empty() && (result.status == 400 || result.status == 415))
+    {
+        state->gzipped.clear();
+        state->plainRetry = true;
+        metrics().increment("http.gzip_rejected");
+        try
+        {
+            submitAttempt(state, std::chrono::milliseconds(0));
+            return;
         }
+        catch (const std::exception &)
+        {
+            // engine shutting down: report the rejected attempt
+        }
+    }
+    // plain JSON went through where gzip did not: stop compressing for this endpoint
+    if (state->plainRetry && result.code == CURLE_OK && result.status > 0 && result.status < 400)
+        gzipRequests = false;
 
-        if (!json.contains("candidates") || json["candidates"].empty()) {
-            throw std::runtime_error("No candidates in Gemini response");
+    std::chrono::milliseconds delay = cancelled ? std::chrono::milliseconds(-1) : retryDelay(*state, result);
+    if (delay.count() >= 0 && std::chrono::steady_clock::now() + delay >= state->deadline)
+    {
+        // no time left for another attempt: report this one
+        delay = std::chrono::milliseconds(-1);
+        metrics().increment("request.deadline_exceeded");
+    }
+    if (delay.count() >= 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            ++state->retries;
+        }
+        metrics().increment("http.retries");
+        try
+        {
+            submitAttempt(state, delay);
+            return;
         }
+        catch (const std::exception &)
+        {
+            // engine shutting down: report the last attempt
+        }
+    }
 
-        const auto& candidate = json["candidates"][0];
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->complete = true;
+    }
+    state->finished.notify_all();
+    if (state->onDone)
+        state->onDone();
+}
+
+// Transport failures that usually succeed on a fresh attempt
+static bool transientCurlError(CURLcode code)
+{
+    switch (code)
+    {
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_HTTP2:
+    case CURLE_HTTP2_STREAM:
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::chrono::milliseconds GeminiClient::retryDelay(const ReplyState& state, const HttpResult& result)
+{
+    const std::chrono::milliseconds noRetry(-1);
+    if (result.cancelled || state.retries >= maxRetries)
+        return noRetry;
+    // part of the reply was already shown; a retry would repeat it
+    if (state.stream && !state.stream->text.empty())
+        return noRetry;
+
+    if (result.code != CURLE_OK)
+        return transientCurlError(result.code) ? backoffDelay(state.retries, retryBase, retryMax) : noRetry;
+
+    // a successful reply is not parsed here: only error bodies (or stray non-SSE text) can carry an API error
+    const std::string &body = state.stream ? state.stream->raw : result.body;
+    std::optional<GeminiApiError> error;
+    if (result.status >= 400 || (state.stream && !body.empty()))
+        error = apiErrorFromBody(body);
+    bool retryable = error ? error->retryable()
+                           : (result.status == 429 || result.status == 500 || result.status == 502 ||
+                              result.status == 503 || result.status == 504);
+    if (!retryable)
+        return noRetry;
+
+    std::chrono::milliseconds delay = backoffDelay(state.retries, retryBase, retryMax);
+    if (error && error->retryDelay().count() > 0)
+    {
+        // the server said when quota frees up: hold back every queued request until then
+        delay = error->retryDelay();
+        bucket.pauseUntil(std::chrono::steady_clock::now() + delay);
+        metrics().increment("http.throttled");
+    }
+    // e.g. a daily quota: waiting would outlast any sensible turn, report the error instead
+    if (delay > retryMax)
+        return noRetry;
+    return delay;
+}
+
+std::string GeminiClient::sendMessage(const nlohmann::json &conversation)
+{
+    return sendPayload(conversation.dump());
+}
+
+std::string GeminiClient::streamMessage(const nlohmann::json &conversation, const ChunkCallback &onChunk)
+{
+    return streamPayload(conversation.dump(), onChunk);
+}
+
+// Blocking request returning the raw response body
+std::string GeminiClient::sendPayload(const std::string &payload)
+{
+    auto reply = start(payload);
+    if (reply->state->cached)
+    {
+        // callers parse the body, so a cached reply is wrapped in a minimal GenerateContentResponse
+        nlohmann::json part;
+        part["text"] = *reply->state->cached;
+        nlohmann::json candidate;
+        candidate["content"]["role"] = "model";
+        candidate["content"]["parts"] = nlohmann::json::array({part});
+        nlohmann::json response;
+        response["candidates"] = nlohmann::json::array({candidate});
+        return response.dump();
+    }
 
-        if (!candidate.contains("content") ||
-            !candidate["content"].contains("parts") ||
-            candidate["content"]["parts"].empty()) {
-            throw std::runtime_error("Invalid Gemini response format");
+    const HttpResult &result = reply->finalResult();
+    if (reply->state->deadlineExceeded)
+    {
+        throw std::runtime_error("No reply within the turn deadline (" + std::to_string(turnDeadlineMs) + " ms)");
+    }
+    if (result.code != CURLE_OK)
+    {
+        throw std::runtime_error(std::string("CURL request failed: ") + curl_easy_strerror(result.code));
+    }
+    // the reply is discarded right after, so the body can be handed over instead of copied
+    std::string body = reply->state->transfer->takeBody();
+    if (cache && !result.cancelled && result.status < 400)
+    {
+        try
+        {
+            cacheReply(*reply->state, extractGeminiReply(body));
+        }
+        catch (const std::exception &)
+        {
+            // not a reply worth keeping; the caller reports it
         }
+    }
+    return body;
+}
 
-        return candidate["content"]["parts"][0]["text"].get<std::string>();
-    } catch (const nlohmann::json::exception &e) {
-        throw std::runtime_error(std::string("Failed to parse Gemini response JSON: ") + e.what());
+void GeminiClient::cacheReply(const ReplyState &state, const std::string &text) const
+{
+    if (cache && !state.cacheKey.empty() && !text.empty() && !cache->store(state.cacheKey, text))
+        metrics().increment("cache.store_failures");
+}
+
+std::string GeminiClient::streamPayload(const std::string &payload, const ChunkCallback &onChunk)
+{
+    return start(payload, onChunk)->get();
+}
+
+bool GeminiApiError::retryable() const {
+    return errorCode == 429 || errorCode == 500 || errorCode == 502 || errorCode == 503 || errorCode == 504 ||
+           errorStatus == "RESOURCE_EXHAUSTED" || errorStatus == "UNAVAILABLE" || errorStatus == "INTERNAL";
+}
+
+// "39s" / "1.5s" (protobuf Duration as JSON) to milliseconds
+static std::chrono::milliseconds parseRetryDelay(const std::string& text) {
+    double seconds = std::strtod(text.c_str(), nullptr);
+    return std::chrono::milliseconds(seconds > 0 ? static_cast<long long>(seconds * 1000) : 0);
+}
+
+// Build the error for an {"error": {...}} response, nothing if the JSON is not an error
+static std::optional<GeminiApiError> apiErrorFromJson(const nlohmann::json& json) {
+    if (!json.is_object() || !json.contains("error") || !json["error"].is_object()) {
+        return std::nullopt;
+    }
+    const auto& error = json["error"];
+    int code = error.value("code", 0);
+    std::string message = error.value("message", "Unknown error");
+    std::string status = error.value("status", "UNKNOWN");
+
+    std::chrono::milliseconds retryDelay(0);
+    std::string retryText;
+    if (error.contains("details") && error["details"].is_array()) {
+        for (const auto& detail_item : error["details"]) {
+            if (detail_item.contains("retryDelay") && detail_item["retryDelay"].is_string()) {
+                retryText = detail_item["retryDelay"].get<std::string>();
+                retryDelay = parseRetryDelay(retryText);
+            }
+        }
+    }
+
+    // Handle rate limiting (429)
+    if (code == 429 || status == "RESOURCE_EXHAUSTED") {
+        std::string detail = "API Rate Limit Exceeded (Free Tier: 20 requests/day per model)\n";
+        detail += "Message: " + message + "\n";
+        if (!retryText.empty()) {
+            detail += "Retry after: " + retryText;
+        }
+        return GeminiApiError(detail, code, status, retryDelay);
+    }
+
+    // Generic API error
+    return GeminiApiError("Gemini API Error (Code " + std::to_string(code) + "): " + message, code, status, retryDelay);
+}
+
+std::optional<GeminiApiError> apiErrorFromBody(const std::string& body) {
+    nlohmann::json json = nlohmann::json::parse(body, nullptr, false);
+    if (json.is_discarded()) {
+        return std::nullopt;
+    }
+    return apiErrorFromJson(json);
+}
+
+// Extract the assistant's reply from the Gemini API response: the text of every part of the first candidate
+std::string GeminiClient::extractGeminiReply(const std::string& responseStr) const {
+    ReplyText reply;
+    if (!extractReplyText(responseStr, reply)) {
+        throw std::runtime_error("Failed to parse Gemini response JSON: " + reply.parseError);
+    }
+
+    // Check for API error response first
+    if (reply.error) {
+        if (std::optional<GeminiApiError> error = apiErrorFromBody(responseStr)) {
+            throw *error;
+        }
+    }
+
+    if (!reply.candidate) {
+        throw std::runtime_error("No candidates in Gemini response");
+    }
+    if (reply.textParts == 0) {
+        throw std::runtime_error("Invalid Gemini response format");
     }
+    return std::move(reply.text);
 }
 
 bool GeminiClient::isConfigured() const {
-    return !apiKey.empty();
+    return !apiKey.empty() || replayOnly;
 }
@@ -0,0 +1,72 @@
+#include "Gzip.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+bool gzipAvailable()
+{
+#ifdef HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool gzipCompress(const std::string &raw, std::string &out, int level)
+{
+#ifdef HAVE_ZLIB
+    z_stream stream = {};
+    // 15 window bits + 16 selects the gzip wrapper instead of zlib's
+    if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    out.resize(deflateBound(&stream, static_cast<uLong>(raw.size())));
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(raw.data()));
+    stream.avail_in = static_cast<uInt>(raw.size());
+    stream.next_out = reinterpret_cast<Bytef *>(out.data());
+    stream.avail_out = static_cast<uInt>(out.size());
+
+    // the output was sized with deflateBound, so one call finishes the stream
+    int rc = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return rc == Z_STREAM_END;
+#else
+    (void)raw;
+    (void)out;
+    (void)level;
+    return false;
+#endif
+}
+
+bool gzipDecompress(const std::string &compressed, std::string &out)
+{
+#ifdef HAVE_ZLIB
+    z_stream stream = {};
+    if (inflateInit2(&stream, 15 + 16) != Z_OK)
+        return false;
+
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(compressed.data()));
+    stream.avail_in = static_cast<uInt>(compressed.size());
+    out.clear();
+    int rc = Z_OK;
+    // JSON usually compresses 4-10x; grow the output until the stream ends
+    size_t capacity = compressed.size() * 4 + 1024;
+    while (rc == Z_OK)
+    {
+        out.resize(capacity);
+        stream.next_out = reinterpret_cast<Bytef *>(out.data() + stream.total_out);
+        stream.avail_out = static_cast<uInt>(capacity - stream.total_out);
+        rc = inflate(&stream, Z_NO_FLUSH);
+        capacity *= 2;
+    }
+    out.resize(stream.total_out);
+    inflateEnd(&stream);
+    return rc == Z_STREAM_END;
+#else
+    (void)compressed;
+    (void)out;
+    return false;
+#endif
+}
@@ -0,0 +1,275 @@
+#include "HistoryReader.h"
+#include "Timestamp.h"
+#include <stdexcept>
+#include <nlohmann/json.hpp>
+
+namespace
+{
+    const char *MISSING_MESSAGES = "Invalid JSON format: 'messages' array is missing should be {messages : [] }";
+    const char *INVALID_MESSAGE = "Invalid Messages format in JSon should be {role,content,timestamp}";
+
+    // SAX handler tracking only the paths we care about:
+    //   depth 1: messages / generation / summary
+    //   depth 2: message objects (inside messages), text / covers (inside summary)
+    //   depth 3: role / content / timestamp (inside a message)
+    // anything else is skipped while keeping the depth count.
+    class HistorySaxHandler : public nlohmann::json_sax<nlohmann::json>
+    {
+    public:
+        explicit HistorySaxHandler(LoadedHistory &out) : out(out) {}
+
+        bool sawMessages = false;
+        bool invalidFormat = false; // top-level structure is wrong (std::invalid_argument)
+        std::string error;
+
+        bool null() override { return scalar(); }
+        bool boolean(bool) override { return scalar(); }
+        bool number_integer(number_integer_t value) override
+        {
+            if (depth == 3 && inMessage && field == Field::timestamp)
+            {
+                current.timestamp = value;
+                hasTimestamp = true;
+                return true;
+            }
+            return scalar();
+        }
+        bool number_float(number_float_t, const string_t &) override { return scalar(); }
+        bool binary(binary_t &) override { return scalar(); }
+
+        bool number_unsigned(number_unsigned_t value) override
+        {
+            if (depth == 3 && inMessage && field == Field::timestamp)
+            {
+                current.timestamp = static_cast<int64_t>(value);
+                hasTimestamp = true;
+                return true;
+            }
+            if (depth == 1 && field == Field::generation)
+                out.generation = value;
+            else if (depth == 2 && inSummary && field == Field::summaryCovers)
+                out.summaryCovers = static_cast<size_t>(value);
+            return scalar();
+        }
+
+        bool string(string_t &value) override
+        {
+            if (depth == 3 && inMessage)
+            {
+                switch (field)
+                {
+                case Field::role:
+                    current.role = Conversation::roleFromString(value);
+                    hasRole = true;
+                    return true;
+                case Field::content:
+                    current.content = out.arena.store(value);
+                    hasContent = true;
+                    return true;
+                case Field::timestamp:
+                    current.timestamp = timestampFromText(value);
+                    hasTimestamp = true;
+                    return true;
+                default:
+                    return true;
+                }
+            }
+            if (depth == 2 && inSummary && field == Field::summaryText)
+            {
+                out.summary = std::move(value);
+                return true;
+            }
+            return scalar();
+        }
+
+        bool start_object(std::size_t) override
+        {
+            if (depth == 0)
+            {
+                ++depth;
+                return true;
+            }
+            if (depth == 1 && field == Field::messages)
+                return fail(true, MISSING_MESSAGES);
+            if (!fieldValueAllowed())
+                return false;
+            if (depth == 1 && field == Field::summary)
+                inSummary = true;
+            if (depth == 2 && inMessages)
+            {
+                inMessage = true;
+                current = Message();
+                hasRole = hasContent = hasTimestamp = false;
+            }
+            ++depth;
+            field = Field::other;
+            return true;
+        }
+
+        bool end_object() override
+        {
+            --depth;
+            field = Field::other;
+            if (depth == 2 && inMessage)
+            {
+                inMessage = false;
+                // Validate each message object
+                if (!hasRole || !hasContent || !hasTimestamp)
+                    return fail(false, INVALID_MESSAGE);
+                out.messages.push_back(current);
+            }
+            else if (depth == 1 && inSummary)
+            {
+                inSummary = false;
+            }
+            return true;
+        }
+
+        bool start_array(std::size_t) override
+        {
+            if (depth == 0)
+                return fail(true, MISSING_MESSAGES);
+            if (depth == 2 && inMessages)
+                return fail(false, INVALID_MESSAGE);
+            if (!fieldValueAllowed())
+                return false;
+            if (depth == 1 && field == Field::messages)
+            {
+                inMessages = true;
+                sawMessages = true;
+            }
+            ++depth;
+            field = Field::other;
+            return true;
+        }
+
+        bool end_array() override
+        {
+            --depth;
+            field = Field::other;
+            if (depth == 1 && inMessages)
+                inMessages = false;
+            return true;
+        }
+
+        bool key(string_t &name) override
+        {
+            field = Field::other;
+            if (depth == 1)
+            {
+                if (name == "messages")
+                    field = Field::messages;
+                else if (name == "generation")
+                    field = Field::generation;
+                else if (name == "summary")
+                    field = Field::summary;
+            }
+            else if (depth == 2 && inSummary)
+            {
+                if (name == "text")
+                    field = Field::summaryText;
+                else if (name == "covers")
+                    field = Field::summaryCovers;
+            }
+            else if (depth == 3 && inMessage)
+            {
+                if (name == "role")
+                    field = Field::role;
+                else if (name == "content")
+                    field = Field::content;
+                else if (name == "timestamp")
+                    field = Field::timestamp;
+            }
+            return true;
+        }
+
+        bool parse_error(std::size_t, const std::string &, const nlohmann::detail::exception &ex) override
+        {
+            error = ex.what();
+            return false;
+        }
+
+    private:
+        enum class Field
+        {
+            other,
+            messages,
+            generation,
+            summary,
+            summaryText,
+            summaryCovers,
+            role,
+            content,
+            timestamp
+        };
+
+        LoadedHistory &out;
+        size_t depth = 0;
+        Field field = Field::other;
+        bool inMessages = false;
+        bool inMessage = false;
+        bool inSummary = false;
+        Message current;
+        bool hasRole = false;
+        bool hasContent = false;
+        bool hasTimestamp = false;
+
+        bool fail(bool structural, const char *message)
+        {
+            invalidFormat = structural;
+            error = message;
+            return false;
+        }
+
+        // role/content/timestamp must be strings and messages must be an array
+        bool fieldValueAllowed()
+        {
+            if (depth == 3 && inMessage && (field == Field::role || field == Field::content || field == Field::timestamp))
+                return fail(false, INVALID_MESSAGE);
+            return true;
+        }
+
+        bool scalar()
+        {
+            if (depth == 0 || (depth == 1 && field == Field::messages))
+                return fail(true, MISSING_MESSAGES);
+            if (depth == 2 && inMessages)
+                return fail(false, INVALID_MESSAGE);
+            return fieldValueAllowed();
+        }
+    };
+}
+
+int64_t timestampFromText(std::string_view text)
+{
+    int64_t epochSeconds = 0;
+    if (parseTimestamp(text, epochSeconds))
+        return epochSeconds;
+    return 0;
+}
+
+int64_t timestampFromJson(const nlohmann::json &value)
+{
+    if (value.is_number_integer())
+        return value.get<int64_t>();
+    if (value.is_string())
+        return timestampFromText(value.get_ref<const std::string &>());
+    throw std::runtime_error(INVALID_MESSAGE);
+}
+
+void parseHistoryJson(const char *begin, const char *end, LoadedHistory &out)
+{
+    HistorySaxHandler handler(out);
+    bool ok = nlohmann::json::sax_parse(begin, end, &handler);
+
+    if (!ok || !handler.error.empty())
+    {
+        if (handler.invalidFormat)
+            throw std::invalid_argument(handler.error);
+        throw std::runtime_error(handler.error.empty() ? "Failed to parse history JSON" : handler.error);
+    }
+    if (!handler.sawMessages)
+    {
+        throw std::invalid_argument(MISSING_MESSAGES);
+    }
+}
@@ -0,0 +1,350 @@
+#include "HttpEngine.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <stdexcept>
+
+// poll interval of the worker; cancellation is also signalled with curl_multi_wakeup
+static const int POLL_TIMEOUT_MS = 100;
+// never trust a Content-Length beyond this for the up-front allocation
+static const size_t MAX_RESERVE_BYTES = 64 * 1024 * 1024;
+
+void HttpTransfer::cancel()
+{
+    cancelFlag = true;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (wakeWorker)
+        wakeWorker();
+}
+
+bool HttpTransfer::cancelRequested() const
+{
+    return cancelFlag;
+}
+
+bool HttpTransfer::done() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return complete;
+}
+
+bool HttpTransfer::waitFor(std::chrono::milliseconds timeout) const
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    return finished.wait_for(lock, timeout, [this] { return complete; });
+}
+
+void HttpTransfer::wait() const
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this] { return complete; });
+}
+
+const HttpResult &HttpTransfer::result() const
+{
+    return outcome;
+}
+
+std::string HttpTransfer::takeBody()
+{
+    return std::move(outcome.body);
+}
+
+size_t HttpTransfer::bytesReceived() const
+{
+    return received;
+}
+
+bool HttpTransfer::deliver(const char *data, size_t size)
+{
+    if (received == 0 && request.onFirstByte)
+        request.onFirstByte();
+    // the callback may have cancelled this transfer (e.g. it lost a race)
+    if (cancelFlag)
+        return false;
+    received += size;
+    if (request.onData)
+        return request.onData(data, size);
+    outcome.body.append(data, size);
+    return true;
+}
+
+void HttpTransfer::expectBody(size_t size)
+{
+    // streamed bodies are consumed as they arrive, nothing to size
+    if (!request.onData)
+        outcome.body.reserve(outcome.body.size() + std::min(size, MAX_RESERVE_BYTES));
+}
+
+static size_t engineWriteCallback(
+    void *contents,
+    size_t size,
+    size_t nmemb,
+    void *userp)
+{
+    size_t total = size * nmemb;
+    HttpTransfer *transfer = static_cast<HttpTransfer *>(userp);
+    if (transfer->cancelRequested())
+        return 0;
+    return transfer->deliver(static_cast<const char *>(contents), total) ? total : 0;
+}
+
+// Picks Content-Length out of the response headers; every other header is ignored
+static size_t engineHeaderCallback(
+    char *buffer,
+    size_t size,
+    size_t nitems,
+    void *userp)
+{
+    size_t total = size * nitems;
+    static const char NAME[] = "content-length:";
+    const size_t nameLength = sizeof(NAME) - 1;
+    if (total > nameLength)
+    {
+        bool match = true;
+        for (size_t i = 0; i < nameLength && match; ++i)
+            match = std::tolower(static_cast<unsigned char>(buffer[i])) == NAME[i];
+        if (match)
+        {
+            std::string value(buffer + nameLength, total - nameLength);
+            char *end = nullptr;
+            unsigned long long length = std::strtoull(value.c_str(), &end, 10);
+            if (end != value.c_str())
+                static_cast<HttpTransfer *>(userp)->expectBody(static_cast<size_t>(length));
+        }
+    }
+    return total;
+}
+
+HttpEngine::HttpEngine()
+{
+    static const CURLcode globalInit = curl_global_init(CURL_GLOBAL_DEFAULT);
+    if (globalInit != CURLE_OK)
+    {
+        throw std::runtime_error(std::string("Failed to initialize CURL: ") + curl_easy_strerror(globalInit));
+    }
+
+    multi = curl_multi_init();
+    if (!multi)
+    {
+        throw std::runtime_error("Failed to initialize CURL multi handle");
+    }
+    // several requests to the same host share one HTTP/2 connection when possible
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+    worker = std::thread([this] { run(); });
+}
+
+HttpEngine::~HttpEngine()
+{
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    wake();
+    if (worker.joinable())
+        worker.join();
+
+    for (CURL *easy : idleHandles)
+        curl_easy_cleanup(easy);
+    curl_multi_cleanup(multi);
+}
+
+std::shared_ptr<HttpTransfer> HttpEngine::submit(HttpRequest request)
+{
+    auto transfer = std::make_shared<HttpTransfer>();
+    transfer->request = std::move(request);
+    transfer->wakeWorker = [this] { wake(); };
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (stopping)
+            throw std::runtime_error("HTTP engine is shutting down");
+        queue.push_back(transfer);
+    }
+    wake();
+    return transfer;
+}
+
+void HttpEngine::wake()
+{
+    curl_multi_wakeup(multi);
+}
+
+// Configure a pooled easy handle for the transfer and hand it to the multi handle
+void HttpEngine::start(const std::shared_ptr<HttpTransfer> &transfer)
+{
+    CURL *easy = nullptr;
+    if (!idleHandles.empty())
+    {
+        easy = idleHandles.back();
+        idleHandles.pop_back();
+        // keeps the handle's connection, DNS and TLS session caches
+        curl_easy_reset(easy);
+    }
+    else
+    {
+        easy = curl_easy_init();
+    }
+
+    if (!easy)
+    {
+        active.push_back({nullptr, transfer});
+        finish(active.size() - 1, CURLE_FAILED_INIT, false);
+        return;
+    }
+
+    const HttpRequest &request = transfer->request;
+    curl_easy_setopt(easy, CURLOPT_URL, request.url.c_str());
+    curl_easy_setopt(easy, CURLOPT_HTTPHEADER, request.headers);
+    curl_easy_setopt(easy, CURLOPT_POSTFIELDS, request.body.data());
+    curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(request.body.size()));
+    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, engineWriteCallback);
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, transfer.get());
+    curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, engineHeaderCallback);
+    curl_easy_setopt(easy, CURLOPT_HEADERDATA, transfer.get());
+    // advertise every encoding curl can decode (gzip, deflate, zstd, br as built); bodies arrive decoded
+    curl_easy_setopt(easy, CURLOPT_ACCEPT_ENCODING, "");
+
+    // keep connections warm between turns, negotiate HTTP/2 over TLS when available
+    curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(easy, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(easy, CURLOPT_TCP_KEEPIDLE, 60L);
+    curl_easy_setopt(easy, CURLOPT_TCP_KEEPINTVL, 30L);
+    curl_easy_setopt(easy, CURLOPT_DNS_CACHE_TIMEOUT, 600L);
+    curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+    if (request.freshConnection)
+        curl_easy_setopt(easy, CURLOPT_FRESH_CONNECT, 1L);
+
+    // deadlines (0 = none)
+    curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT_MS, request.connectTimeoutMs);
+    curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, request.timeoutMs);
+
+    active.push_back({easy, transfer});
+    CURLMcode added = curl_multi_add_handle(multi, easy);
+    if (added != CURLM_OK)
+    {
+        finish(active.size() - 1, CURLE_FAILED_INIT, false);
+    }
+}
+
+// Publish the result and recycle the easy handle; the active entry is removed
+void HttpEngine::finish(size_t index, CURLcode code, bool cancelled)
+{
+    Active entry = active[index];
+    active[index] = active.back();
+    active.pop_back();
+
+    HttpTransfer &transfer = *entry.transfer;
+    if (entry.easy)
+    {
+        curl_easy_getinfo(entry.easy, CURLINFO_RESPONSE_CODE, &transfer.outcome.status);
+        HttpTimings &timings = transfer.outcome.timings;
+        curl_easy_getinfo(entry.easy, CURLINFO_NAMELOOKUP_TIME_T, &timings.nameLookup);
+        curl_easy_getinfo(entry.easy, CURLINFO_CONNECT_TIME_T, &timings.connect);
+        curl_easy_getinfo(entry.easy, CURLINFO_APPCONNECT_TIME_T, &timings.appConnect);
+        curl_easy_getinfo(entry.easy, CURLINFO_PRETRANSFER_TIME_T, &timings.preTransfer);
+        curl_easy_getinfo(entry.easy, CURLINFO_STARTTRANSFER_TIME_T, &timings.startTransfer);
+        curl_easy_getinfo(entry.easy, CURLINFO_TOTAL_TIME_T, &timings.total);
+        curl_easy_getinfo(entry.easy, CURLINFO_NUM_CONNECTS, &timings.newConnections);
+        curl_easy_getinfo(entry.easy, CURLINFO_SIZE_UPLOAD_T, &timings.bytesUploaded);
+        curl_easy_getinfo(entry.easy, CURLINFO_SIZE_DOWNLOAD_T, &timings.bytesDownloaded);
+        curl_multi_remove_handle(multi, entry.easy);
+        idleHandles.push_back(entry.easy);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(transfer.mutex);
+        transfer.outcome.code = code;
+        transfer.outcome.cancelled = cancelled;
+        transfer.wakeWorker = nullptr;
+        transfer.complete = true;
+    }
+    transfer.finished.notify_all();
+
+    // callbacks may own state that owns this transfer; release them once they are done
+    std::function<void()> onComplete = std::move(transfer.request.onComplete);
+    transfer.request.onComplete = nullptr;
+    transfer.request.onData = nullptr;
+    transfer.request.onFirstByte = nullptr;
+    if (onComplete)
+        onComplete();
+}
+
+// Complete a transfer that never reached the multi handle
+void HttpEngine::drop(const std::shared_ptr<HttpTransfer> &transfer)
+{
+    active.push_back({nullptr, transfer});
+    finish(active.size() - 1, CURLE_ABORTED_BY_CALLBACK, true);
+}
+
+void HttpEngine::run()
+{
+    while (true)
+    {
+        std::deque<std::shared_ptr<HttpTransfer>> incoming;
+        bool stop;
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            incoming.swap(queue);
+            stop = stopping;
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        for (auto &transfer : incoming)
+            delayed.push_back(std::move(transfer));
+
+        // start what is due, drop what was cancelled while waiting; note the next deadline for the poll timeout
+        int pollTimeout = POLL_TIMEOUT_MS;
+        std::vector<std::shared_ptr<HttpTransfer>> waiting;
+        for (auto &transfer : delayed)
+        {
+            if (stop || transfer->cancelRequested())
+            {
+                drop(transfer);
+            }
+            else if (transfer->request.notBefore <= now)
+            {
+                start(transfer);
+            }
+            else
+            {
+                auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(transfer->request.notBefore - now).count() + 1;
+                pollTimeout = std::min<int>(pollTimeout, static_cast<int>(wait));
+                waiting.push_back(std::move(transfer));
+            }
+        }
+        delayed.swap(waiting);
+
+        // cancelled transfers are dropped right away instead of waiting for their next write
+        for (size_t i = active.size(); i-- > 0;)
+        {
+            if (stop || active[i].transfer->cancelRequested())
+                finish(i, CURLE_ABORTED_BY_CALLBACK, true);
+        }
+
+        if (stop)
+            return;
+
+        int running = 0;
+        curl_multi_perform(multi, &running);
+
+        CURLMsg *msg;
+        int pending;
+        while ((msg = curl_multi_info_read(multi, &pending)))
+        {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            for (size_t i = 0; i < active.size(); ++i)
+            {
+                if (active[i].easy == msg->easy_handle)
+                {
+                    bool cancelled = active[i].transfer->cancelRequested();
+                    finish(i, msg->data.result, cancelled);
+                    break;
+                }
+            }
+        }
+
+        curl_multi_poll(multi, nullptr, 0, pollTimeout, nullptr);
+    }
+}
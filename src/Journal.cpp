@@ -0,0 +1,160 @@
+#include "Journal.h"
+#include "Conversation.h"
+#include "HistoryReader.h"
+#include "FileSync.h"
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+#include <nlohmann/json.hpp>
+
+Journal::Journal(std::string path) : path(std::move(path)) {}
+
+const std::string &Journal::getPath() const
+{
+    return path;
+}
+
+size_t Journal::records() const
+{
+    return recordCount;
+}
+
+// Replay journal records on top of the snapshot messages.
+// Layout: first line is a header {"generation": N}, then one {"index","role","content","timestamp"} per line.
+bool Journal::replay(uint64_t generation, std::vector<Message> &messages, StringArena &arena, size_t first)
+{
+    recordCount = 0;
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+
+    std::string line;
+    std::streamoff goodOffset = 0;
+    bool headerOk = false;
+    bool torn = false;
+
+    while (std::getline(in, line))
+    {
+        // a line without its trailing newline was cut short by a crash mid-write
+        if (in.eof())
+        {
+            torn = true;
+            break;
+        }
+
+        nlohmann::json record = nlohmann::json::parse(line, nullptr, false);
+        if (record.is_discarded() || !record.is_object())
+        {
+            torn = true;
+            break;
+        }
+
+        if (!headerOk)
+        {
+            // a journal from another generation is left over from an interrupted compaction
+            auto stored = record.find("generation");
+            if (stored == record.end() || !stored->is_number_unsigned() || stored->get<uint64_t>() != generation ||
+                record.contains("index"))
+                return false;
+            headerOk = true;
+        }
+        else
+        {
+            // fields of the wrong type are treated like a torn record instead of throwing from get<>()
+            if (!record.contains("index") || !record["index"].is_number_unsigned() || !record.contains("role") ||
+                !record["role"].is_string() || !record.contains("content") || !record["content"].is_string() ||
+                !record.contains("timestamp") || !(record["timestamp"].is_number_integer() || record["timestamp"].is_string()))
+            {
+                torn = true;
+                break;
+            }
+
+            size_t index = record["index"].get<size_t>();
+            // records already folded into the snapshot are skipped, a gap means the tail is unusable
+            if (index > first + messages.size())
+            {
+                torn = true;
+                break;
+            }
+            if (index == first + messages.size())
+            {
+                Message msg;
+                msg.role = Conversation::roleFromString(record["role"].get<std::string>());
+                msg.content = arena.store(record["content"].get<std::string>());
+                msg.timestamp = timestampFromJson(record["timestamp"]);
+                messages.push_back(msg);
+            }
+            ++recordCount;
+        }
+        goodOffset = in.tellg();
+    }
+
+    if (!headerOk)
+        return false;
+
+    if (torn)
+    {
+        in.close();
+        std::error_code ec;
+        std::filesystem::resize_file(path, static_cast<uintmax_t>(goodOffset), ec);
+        if (ec)
+        {
+            std::cerr << "Warning: failed to truncate torn journal " << path << ": " << ec.message() << "\n";
+            return false;
+        }
+        std::cerr << "Warning: discarded incomplete journal record in " << path << "\n";
+    }
+    return true;
+}
+
+// One JSON line per message, time complexity O(new messages)
+std::string Journal::encode(const std::vector<Message> &messages, size_t from, size_t first)
+{
+    std::string buffer;
+    for (size_t i = from - first; i < messages.size(); ++i)
+    {
+        nlohmann::json record;
+        record["index"] = first + i;
+        record["role"] = Conversation::roleToString(messages[i].role);
+        record["content"] = messages[i].content;
+        // epoch seconds: no formatting on the per-turn path
+        record["timestamp"] = messages[i].timestamp;
+        buffer += record.dump();
+        buffer += '\n';
+    }
+    return buffer;
+}
+
+bool Journal::appendRecords(const std::string &path, const std::string &records)
+{
+    if (records.empty())
+        return true;
+
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    if (!out)
+        return false;
+    out.write(records.data(), static_cast<std::streamsize>(records.size()));
+    out.close();
+    // one fsync for every record of this append
+    return out && syncFile(path);
+}
+
+void Journal::recorded(size_t count)
+{
+    recordCount += count;
+}
+
+// Start a fresh journal for a new snapshot generation
+bool Journal::create(const std::string &path, uint64_t generation)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+        return false;
+
+    nlohmann::json header;
+    header["generation"] = generation;
+    out << header.dump() << '\n';
+    out.close();
+    // the journal may have just been created: sync its directory entry as well
+    return out && syncFile(path) && syncParentDirectory(path);
+}
@@ -0,0 +1,90 @@
+#include "MappedFile.h"
+#include <cerrno>
+#include <cstring>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+    : ptr(std::exchange(other.ptr, nullptr)), length(std::exchange(other.length, 0))
+{
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        ptr = std::exchange(other.ptr, nullptr);
+        length = std::exchange(other.length, 0);
+    }
+    return *this;
+}
+
+bool MappedFile::open(const std::string &FILENAME, std::string &error)
+{
+    close();
+
+    int fd = ::open(FILENAME.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        error = std::strerror(errno);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        error = std::strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    if (st.st_size == 0)
+    {
+        error = "file is empty";
+        ::close(fd);
+        return false;
+    }
+
+    void *mapped = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after the descriptor is closed
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        error = std::strerror(errno);
+        return false;
+    }
+
+    // loaders read front to back: let the kernel read ahead aggressively
+    madvise(mapped, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+    ptr = static_cast<const char *>(mapped);
+    length = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (ptr)
+    {
+        munmap(const_cast<char *>(ptr), length);
+        ptr = nullptr;
+        length = 0;
+    }
+}
+
+const char *MappedFile::data() const
+{
+    return ptr;
+}
+
+size_t MappedFile::size() const
+{
+    return length;
+}
@@ -0,0 +1,198 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+const std::vector<double> &Histogram::bounds()
+{
+    static const std::vector<double> values = {
+        0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25, 50, 100, 250, 500,
+        1000, 2500, 5000, 10000, 30000, 60000, 120000, 300000};
+    return values;
+}
+
+Histogram::Histogram() : buckets(bounds().size() + 1, 0) {}
+
+void Histogram::record(double ms)
+{
+    const std::vector<double> &limits = bounds();
+    size_t bucket = std::lower_bound(limits.begin(), limits.end(), ms) - limits.begin();
+    ++buckets[bucket];
+
+    if (samples == 0 || ms < min)
+        min = ms;
+    if (samples == 0 || ms > max)
+        max = ms;
+    ++samples;
+    sum += ms;
+}
+
+uint64_t Histogram::count() const
+{
+    return samples;
+}
+
+double Histogram::mean() const
+{
+    return samples ? sum / samples : 0;
+}
+
+double Histogram::percentile(double q) const
+{
+    if (samples == 0)
+        return 0;
+
+    const std::vector<double> &limits = bounds();
+    double rank = q * samples;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i)
+    {
+        if (buckets[i] == 0 || seen + buckets[i] < rank)
+        {
+            seen += buckets[i];
+            continue;
+        }
+        // interpolate inside the bucket, clamped to the observed range
+        double lower = i == 0 ? min : limits[i - 1];
+        double upper = i < limits.size() ? limits[i] : max;
+        double fraction = (rank - seen) / buckets[i];
+        double value = lower + (upper - lower) * fraction;
+        return std::clamp(value, min, max);
+    }
+    return max;
+}
+
+nlohmann::json Histogram::toJson() const
+{
+    // cumulative bucket counts, Prometheus style
+    nlohmann::json cumulative = nlohmann::json::array();
+    const std::vector<double> &limits = bounds();
+    uint64_t running = 0;
+    for (size_t i = 0; i < buckets.size(); ++i)
+    {
+        running += buckets[i];
+        nlohmann::json le = i < limits.size() ? nlohmann::json(limits[i]) : nlohmann::json("+Inf");
+        cumulative.push_back({{"le", le}, {"count", running}});
+    }
+
+    return {
+        {"count", samples},
+        {"sum", sum},
+        {"min", min},
+        {"max", max},
+        {"mean", mean()},
+        {"p50", percentile(0.5)},
+        {"p90", percentile(0.9)},
+        {"p99", percentile(0.99)},
+        {"buckets", cumulative}};
+}
+
+void MetricsRegistry::record(const std::string &name, double ms)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    histograms[name].record(ms);
+}
+
+void MetricsRegistry::increment(const std::string &name, uint64_t by)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    counters[name] += by;
+}
+
+std::string MetricsRegistry::report() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2);
+
+    if (histograms.empty() && counters.empty())
+    {
+        out << "No metrics recorded yet.\n";
+        return out.str();
+    }
+
+    if (!histograms.empty())
+    {
+        out << std::left << std::setw(22) << "Timing (ms)" << std::right
+            << std::setw(8) << "count" << std::setw(11) << "mean" << std::setw(11) << "p50"
+            << std::setw(11) << "p90" << std::setw(11) << "p99" << std::setw(11) << "max" << "\n";
+        for (const auto &[name, histogram] : histograms)
+        {
+            out << std::left << std::setw(22) << name << std::right
+                << std::setw(8) << histogram.count()
+                << std::setw(11) << histogram.mean()
+                << std::setw(11) << histogram.percentile(0.5)
+                << std::setw(11) << histogram.percentile(0.9)
+                << std::setw(11) << histogram.percentile(0.99)
+                << std::setw(11) << histogram.percentile(1.0) << "\n";
+        }
+    }
+
+    if (!counters.empty())
+    {
+        out << "\nCounters:\n";
+        for (const auto &[name, value] : counters)
+        {
+            out << "  " << std::left << std::setw(34) << name << value << "\n";
+        }
+    }
+    return out.str();
+}
+
+nlohmann::json MetricsRegistry::toJson() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    nlohmann::json result;
+    result["uptime_seconds"] = elapsedMs(started) / 1000.0;
+    result["histograms"] = nlohmann::json::object();
+    for (const auto &[name, histogram] : histograms)
+        result["histograms"][name] = histogram.toJson();
+    result["counters"] = counters;
+    return result;
+}
+
+bool MetricsRegistry::writeToFile(const std::string &FILENAME) const
+{
+    const std::string tmp = FILENAME + ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::trunc);
+        if (!file)
+            return false;
+        file << toJson().dump(2) << "\n";
+        if (!file)
+            return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, FILENAME, ec);
+    if (ec)
+    {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+MetricsRegistry &metrics()
+{
+    static MetricsRegistry registry;
+    return registry;
+}
+
+ScopedTimer::ScopedTimer(std::string name) : name(std::move(name)), begin(std::chrono::steady_clock::now()) {}
+
+ScopedTimer::~ScopedTimer()
+{
+    if (!stopped)
+        stop();
+}
+
+double ScopedTimer::stop()
+{
+    double ms = elapsedMs(begin);
+    if (!stopped)
+        metrics().record(name, ms);
+    stopped = true;
+    return ms;
+}
@@ -0,0 +1,83 @@
+#include "PersistenceWorker.h"
+#include <algorithm>
+#include "Metrics.h"
+
+PersistenceWorker::PersistenceWorker(SaveFunction save) : save(std::move(save))
+{
+    thread = std::thread(&PersistenceWorker::run, this);
+}
+
+PersistenceWorker::~PersistenceWorker()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+}
+
+void PersistenceWorker::markDirty(const std::string &key)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (std::find(dirty.begin(), dirty.end(), key) != dirty.end())
+        {
+            // already queued: the pending pass picks up this change too
+            metrics().increment("persist.coalesced");
+            return;
+        }
+        dirty.push_back(key);
+    }
+    wake.notify_one();
+}
+
+void PersistenceWorker::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]
+              { return dirty.empty() && !writing; });
+}
+
+std::vector<std::string> PersistenceWorker::takeErrors()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> taken;
+    taken.swap(errors);
+    return taken;
+}
+
+void PersistenceWorker::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        wake.wait(lock, [this]
+                  { return stopping || !dirty.empty(); });
+        if (dirty.empty())
+            break;
+
+        // everything marked up to now goes out in this pass; later marks wait for the next one
+        std::vector<std::string> batch;
+        batch.swap(dirty);
+        writing = true;
+        lock.unlock();
+
+        std::vector<std::string> failures;
+        for (const std::string &key : batch)
+        {
+            ScopedTimer timer("persist.write");
+            std::string error;
+            if (!save(key, error))
+            {
+                metrics().increment("persist.failures");
+                failures.push_back(error.empty() ? "failed to save " + key : error);
+            }
+        }
+
+        lock.lock();
+        errors.insert(errors.end(), failures.begin(), failures.end());
+        writing = false;
+        idle.notify_all();
+    }
+}
@@ -0,0 +1,43 @@
+#include "RateLimiter.h"
+#include <algorithm>
+#include <random>
+
+using Clock = std::chrono::steady_clock;
+
+void TokenBucket::configure(double rate, double capacity)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->interval = rate > 0 ? 1.0 / rate : 0;
+    this->capacity = std::max(1.0, capacity);
+}
+
+Clock::time_point TokenBucket::reserve()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Clock::time_point now = Clock::now();
+    Clock::time_point start = std::max(now, pausedUntil);
+    if (interval <= 0)
+        return start;
+
+    // GCRA: a request may start once the theoretical arrival time is within the burst tolerance
+    auto step = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(interval));
+    auto tolerance = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(interval * (capacity - 1)));
+    start = std::max(start, nextFree - tolerance);
+    nextFree = std::max(nextFree, start) + step;
+    return start;
+}
+
+void TokenBucket::pauseUntil(Clock::time_point until)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    pausedUntil = std::max(pausedUntil, until);
+}
+
+std::chrono::milliseconds backoffDelay(int attempt, std::chrono::milliseconds base, std::chrono::milliseconds cap)
+{
+    thread_local std::mt19937 rng(std::random_device{}());
+    long long ceiling = base.count() << std::min(attempt, 20);
+    ceiling = std::min<long long>(ceiling, cap.count());
+    std::uniform_int_distribution<long long> jitter(std::min<long long>(base.count(), ceiling), ceiling);
+    return std::chrono::milliseconds(jitter(rng));
+}
@@ -0,0 +1,480 @@
+#include "RelevanceIndex.h"
+#include "FileSync.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+// standard BM25 parameters: term frequency saturation and document length normalisation
+static const double BM25_K1 = 1.2;
+static const double BM25_B = 0.75;
+// longer runs (hashes, base64, minified code) are cut to this many bytes
+static const size_t MAX_TERM_BYTES = 32;
+
+static const char INDEX_MAGIC[4] = {'G', 'C', 'S', 'I'};
+static const uint32_t INDEX_VERSION = 1;
+static const size_t INDEX_HEADER_SIZE = 40;
+
+static bool isStopWord(const std::string &term)
+{
+    // sorted for binary search
+    static const char *const WORDS[] = {
+        "about", "after", "all", "also", "an", "and", "any", "are", "as", "at", "be", "been", "but", "by",
+        "can", "could", "did", "do", "does", "for", "from", "had", "has", "have", "he", "her", "his", "how",
+        "if", "in", "into", "is", "it", "its", "just", "me", "more", "my", "no", "not", "of", "on", "one",
+        "or", "our", "out", "she", "so", "some", "than", "that", "the", "their", "them", "then", "there",
+        "these", "they", "this", "to", "up", "us", "was", "we", "were", "what", "when", "which", "who",
+        "will", "with", "would", "you", "your"};
+    return std::binary_search(std::begin(WORDS), std::end(WORDS), term,
+                              [](const auto &a, const auto &b)
+                              { return std::string_view(a) < std::string_view(b); });
+}
+
+// Call fn(term) for every indexable term of text, in order
+template <typename Fn>
+static void forEachTerm(std::string_view text, Fn fn)
+{
+    std::string term;
+    auto flush = [&]()
+    {
+        if (term.size() > 1 && !isStopWord(term))
+            fn(term);
+        term.clear();
+    };
+    for (char ch : text)
+    {
+        unsigned char c = static_cast<unsigned char>(ch);
+        if (c >= 0x80 || std::isalnum(c))
+        {
+            if (term.size() < MAX_TERM_BYTES)
+                term += static_cast<char>(c < 0x80 ? std::tolower(c) : c);
+        }
+        else if (!term.empty())
+        {
+            flush();
+        }
+    }
+    if (!term.empty())
+        flush();
+}
+
+static void putVarint(std::string &out, uint32_t v)
+{
+    while (v >= 0x80)
+    {
+        out += static_cast<char>((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    out += static_cast<char>(v);
+}
+
+static uint32_t getVarint(const char *&p)
+{
+    uint32_t v = 0;
+    for (int shift = 0;; shift += 7)
+    {
+        unsigned char byte = static_cast<unsigned char>(*p++);
+        v |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return v;
+    }
+}
+
+// little-endian encoding helpers (same layout rules as the binary session format)
+static void putU32(std::string &out, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i)
+        out += static_cast<char>((v >> (8 * i)) & 0xFF);
+}
+
+static void putU64(std::string &out, uint64_t v)
+{
+    for (int i = 0; i < 8; ++i)
+        out += static_cast<char>((v >> (8 * i)) & 0xFF);
+}
+
+static uint64_t getLE(const char *p, int bytes)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; ++i)
+        v |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+    return v;
+}
+
+// Walks the postings of one term: document by document, positions on demand
+class PostingCursor
+{
+private:
+    const char *p;
+    const char *end;
+    uint32_t remaining = 0;
+
+public:
+    uint32_t doc = 0;
+    uint32_t frequency = 0;
+
+    explicit PostingCursor(const std::string &postings) : p(postings.data()), end(postings.data() + postings.size()) {}
+
+    // Advance to the next document; the positions of the current one must have been read or skipped
+    bool next()
+    {
+        if (p >= end)
+            return false;
+        doc += getVarint(p);
+        frequency = getVarint(p);
+        remaining = frequency;
+        return true;
+    }
+
+    void positions(std::vector<uint32_t> &out)
+    {
+        out.clear();
+        uint32_t position = 0;
+        for (; remaining > 0; --remaining)
+        {
+            position += getVarint(p);
+            out.push_back(position);
+        }
+    }
+
+    void skipPositions()
+    {
+        for (; remaining > 0; --remaining)
+        {
+            while (static_cast<unsigned char>(*p++) & 0x80)
+            {
+            }
+        }
+    }
+};
+
+void RelevanceIndex::add(std::string_view text)
+{
+    const uint32_t doc = static_cast<uint32_t>(lengths.size());
+
+    // (term, position) pairs, grouped by term below so each term's entry is written in one go
+    std::vector<std::pair<uint32_t, uint32_t>> occurrences;
+    uint32_t position = 0;
+    forEachTerm(text, [&](const std::string &term)
+                {
+        // find before emplace: emplace allocates a node even for a term that is already known
+        auto it = termIds.find(term);
+        if (it == termIds.end())
+        {
+            it = termIds.emplace(term, static_cast<uint32_t>(terms.size())).first;
+            terms.emplace_back();
+        }
+        occurrences.emplace_back(it->second, position++); });
+    std::sort(occurrences.begin(), occurrences.end());
+
+    for (size_t i = 0; i < occurrences.size();)
+    {
+        size_t j = i;
+        while (j < occurrences.size() && occurrences[j].first == occurrences[i].first)
+            ++j;
+        Term &entry = terms[occurrences[i].first];
+        putVarint(entry.postings, doc - entry.lastDoc);
+        putVarint(entry.postings, static_cast<uint32_t>(j - i));
+        uint32_t previous = 0;
+        for (size_t k = i; k < j; ++k)
+        {
+            putVarint(entry.postings, occurrences[k].second - previous);
+            previous = occurrences[k].second;
+        }
+        entry.lastDoc = doc;
+        ++entry.documents;
+        i = j;
+    }
+
+    lengths.push_back(position);
+    totalLength += position;
+}
+
+void RelevanceIndex::clear()
+{
+    termIds.clear();
+    terms.clear();
+    lengths.clear();
+    totalLength = 0;
+}
+
+size_t RelevanceIndex::size() const
+{
+    return lengths.size();
+}
+
+std::vector<std::pair<size_t, double>> RelevanceIndex::rank(const std::vector<uint32_t> &queryTerms, size_t k, size_t limit,
+                                                            const std::vector<uint32_t> *only) const
+{
+    std::vector<std::pair<size_t, double>> ranked;
+    limit = std::min(limit, lengths.size());
+    if (k == 0 || limit == 0 || totalLength == 0 || queryTerms.empty())
+        return ranked;
+
+    const double documents = static_cast<double>(lengths.size());
+    const double averageLength = static_cast<double>(totalLength) / documents;
+    std::vector<double> scores(limit, 0.0);
+    for (uint32_t term : queryTerms)
+    {
+        const Term &entry = terms[term];
+        const double df = entry.documents;
+        const double idf = std::log(1.0 + (documents - df + 0.5) / (df + 0.5));
+        PostingCursor cursor(entry.postings);
+        while (cursor.next() && cursor.doc < limit)
+        {
+            const double tf = cursor.frequency;
+            const double norm = BM25_K1 * (1.0 - BM25_B + BM25_B * lengths[cursor.doc] / averageLength);
+            scores[cursor.doc] += idf * tf * (BM25_K1 + 1.0) / (tf + norm);
+            cursor.skipPositions();
+        }
+    }
+
+    if (only)
+    {
+        for (uint32_t doc : *only)
+        {
+            if (doc < limit && scores[doc] > 0)
+                ranked.emplace_back(doc, scores[doc]);
+        }
+    }
+    else
+    {
+        for (size_t doc = 0; doc < limit; ++doc)
+        {
+            if (scores[doc] > 0)
+                ranked.emplace_back(doc, scores[doc]);
+        }
+    }
+    // best first; among equal scores the more recent message wins
+    auto better = [](const std::pair<size_t, double> &a, const std::pair<size_t, double> &b)
+    { return a.second != b.second ? a.second > b.second : a.first > b.first; };
+    if (ranked.size() > k)
+    {
+        std::partial_sort(ranked.begin(), ranked.begin() + k, ranked.end(), better);
+        ranked.resize(k);
+    }
+    else
+    {
+        std::sort(ranked.begin(), ranked.end(), better);
+    }
+    return ranked;
+}
+
+std::vector<uint32_t> RelevanceIndex::phraseDocuments(const std::vector<uint32_t> &phraseTerms) const
+{
+    // (document, positions where the phrase could start), narrowed term by term
+    std::vector<std::pair<uint32_t, std::vector<uint32_t>>> candidates;
+    std::vector<uint32_t> positions;
+    for (size_t i = 0; i < phraseTerms.size(); ++i)
+    {
+        PostingCursor cursor(terms[phraseTerms[i]].postings);
+        std::vector<std::pair<uint32_t, std::vector<uint32_t>>> narrowed;
+        size_t c = 0;
+        while (cursor.next())
+        {
+            if (i > 0)
+            {
+                while (c < candidates.size() && candidates[c].first < cursor.doc)
+                    ++c;
+                if (c == candidates.size())
+                    break;
+                if (candidates[c].first != cursor.doc)
+                {
+                    cursor.skipPositions();
+                    continue;
+                }
+            }
+            cursor.positions(positions);
+            if (i == 0)
+            {
+                narrowed.emplace_back(cursor.doc, positions);
+                continue;
+            }
+            // keep the starts whose i-th word follows at start + i
+            std::vector<uint32_t> starts;
+            for (uint32_t start : candidates[c].second)
+            {
+                if (std::binary_search(positions.begin(), positions.end(), start + static_cast<uint32_t>(i)))
+                    starts.push_back(start);
+            }
+            if (!starts.empty())
+                narrowed.emplace_back(cursor.doc, std::move(starts));
+        }
+        candidates.swap(narrowed);
+        if (candidates.empty())
+            break;
+    }
+
+    std::vector<uint32_t> docs;
+    docs.reserve(candidates.size());
+    for (const auto &candidate : candidates)
+        docs.push_back(candidate.first);
+    return docs;
+}
+
+std::vector<std::pair<size_t, double>> RelevanceIndex::search(std::string_view query, size_t k, size_t limit) const
+{
+    // each query term counts once, however often it is repeated
+    std::vector<uint32_t> queryTerms;
+    forEachTerm(query, [&](const std::string &term)
+                {
+        auto it = termIds.find(term);
+        if (it != termIds.end() && std::find(queryTerms.begin(), queryTerms.end(), it->second) == queryTerms.end())
+            queryTerms.push_back(it->second); });
+    return rank(queryTerms, k, limit, nullptr);
+}
+
+std::vector<std::pair<size_t, double>> RelevanceIndex::find(std::string_view query, size_t k) const
+{
+    std::vector<uint32_t> queryTerms;
+    std::vector<uint32_t> allowed;
+    bool restricted = false;
+
+    // alternate between unquoted and quoted segments
+    bool quoted = false;
+    size_t begin = 0;
+    while (begin <= query.size())
+    {
+        size_t quote = query.find('"', begin);
+        std::string_view segment = query.substr(begin, quote == std::string_view::npos ? std::string_view::npos : quote - begin);
+
+        std::vector<uint32_t> segmentTerms;
+        bool unknown = false;
+        forEachTerm(segment, [&](const std::string &term)
+                    {
+            auto it = termIds.find(term);
+            if (it == termIds.end())
+            {
+                unknown = true;
+                return;
+            }
+            segmentTerms.push_back(it->second);
+            if (std::find(queryTerms.begin(), queryTerms.end(), it->second) == queryTerms.end())
+                queryTerms.push_back(it->second); });
+
+        if (quoted && (unknown || !segmentTerms.empty()))
+        {
+            // a phrase with a word that was never indexed matches nothing
+            std::vector<uint32_t> docs = unknown ? std::vector<uint32_t>() : phraseDocuments(segmentTerms);
+            if (restricted)
+            {
+                std::vector<uint32_t> both;
+                std::set_intersection(allowed.begin(), allowed.end(), docs.begin(), docs.end(), std::back_inserter(both));
+                allowed.swap(both);
+            }
+            else
+            {
+                allowed.swap(docs);
+                restricted = true;
+            }
+        }
+
+        if (quote == std::string_view::npos)
+            break;
+        begin = quote + 1;
+        quoted = !quoted;
+    }
+
+    if (restricted && allowed.empty())
+        return {};
+    return rank(queryTerms, k, lengths.size(), restricted ? &allowed : nullptr);
+}
+
+bool RelevanceIndex::save(const std::string &FILENAME, uint64_t generation) const
+{
+    return replaceFile(FILENAME, serialize(generation));
+}
+
+std::string RelevanceIndex::serialize(uint64_t generation) const
+{
+    std::string buffer(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    putU32(buffer, INDEX_VERSION);
+    putU64(buffer, generation);
+    putU64(buffer, lengths.size());
+    putU64(buffer, totalLength);
+    putU64(buffer, terms.size());
+    for (uint32_t length : lengths)
+        putU32(buffer, length);
+
+    // terms in id order, so ids survive a round trip
+    std::vector<const std::string *> names(terms.size());
+    for (const auto &[name, id] : termIds)
+        names[id] = &name;
+    for (size_t id = 0; id < terms.size(); ++id)
+    {
+        const Term &entry = terms[id];
+        buffer += static_cast<char>(names[id]->size());
+        buffer += *names[id];
+        putU32(buffer, entry.documents);
+        putU32(buffer, entry.lastDoc);
+        putU64(buffer, entry.postings.size());
+        buffer += entry.postings;
+    }
+    return buffer;
+}
+
+bool RelevanceIndex::load(const std::string &FILENAME, uint64_t generation, size_t documents)
+{
+    clear();
+    MappedFile file;
+    std::string error;
+    if (!file.open(FILENAME, error))
+        return false;
+
+    const char *p = file.data();
+    const char *end = p + file.size();
+    if (file.size() < INDEX_HEADER_SIZE || std::memcmp(p, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+        getLE(p + 4, 4) != INDEX_VERSION || getLE(p + 8, 8) != generation || getLE(p + 16, 8) != documents)
+        return false;
+    const uint64_t termCount = getLE(p + 32, 8);
+    p += INDEX_HEADER_SIZE;
+
+    // a stale or torn index is simply rebuilt from the messages
+    auto fail = [this]()
+    {
+        clear();
+        return false;
+    };
+    if (static_cast<uint64_t>(end - p) / 4 < documents)
+        return fail();
+    lengths.resize(documents);
+    for (size_t i = 0; i < documents; ++i, p += 4)
+    {
+        lengths[i] = static_cast<uint32_t>(getLE(p, 4));
+        totalLength += lengths[i];
+    }
+
+    // every term takes at least its length byte and 16 bytes of counts: a larger count is not this file's
+    if (termCount > static_cast<uint64_t>(end - p) / 17)
+        return fail();
+    termIds.reserve(termCount);
+    terms.reserve(termCount);
+    for (uint64_t id = 0; id < termCount; ++id)
+    {
+        if (end - p < 1)
+            return fail();
+        size_t nameLength = static_cast<unsigned char>(*p++);
+        if (static_cast<size_t>(end - p) < nameLength + 16)
+            return fail();
+        std::string name(p, nameLength);
+        p += nameLength;
+        Term entry;
+        entry.documents = static_cast<uint32_t>(getLE(p, 4));
+        entry.lastDoc = static_cast<uint32_t>(getLE(p + 4, 4));
+        uint64_t bytes = getLE(p + 8, 8);
+        p += 16;
+        if (static_cast<uint64_t>(end - p) < bytes || entry.lastDoc >= documents)
+            return fail();
+        entry.postings.assign(p, bytes);
+        p += bytes;
+        if (!termIds.emplace(std::move(name), static_cast<uint32_t>(id)).second)
+            return fail();
+        terms.push_back(std::move(entry));
+    }
+    if (totalLength != getLE(file.data() + 24, 8))
+        return fail();
+    return true;
+}
@@ -0,0 +1,162 @@
+#include "ResponseCache.h"
+#include "Metrics.h"
+#include "Sha256.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+static const char *const ENTRY_EXTENSION = ".reply";
+
+ResponseCache::ResponseCache(std::filesystem::path dir, uint64_t maxBytes) : dir(std::move(dir)), maxBytes(maxBytes) {}
+
+std::filesystem::path ResponseCache::pathOf(const std::string &key) const
+{
+    return dir / (key + ENTRY_EXTENSION);
+}
+
+bool ResponseCache::open(std::string &error)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec)
+    {
+        error = "cannot create " + dir.string() + ": " + ec.message();
+        return false;
+    }
+
+    // the modification time is the last use: a hit touches the file
+    std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::directory_entry>> found;
+    for (const auto &entry : std::filesystem::directory_iterator(dir, ec))
+    {
+        if (entry.path().extension() == ENTRY_EXTENSION && entry.is_regular_file(ec))
+            found.emplace_back(entry.last_write_time(ec), entry);
+    }
+    if (ec)
+    {
+        error = "cannot list " + dir.string() + ": " + ec.message();
+        return false;
+    }
+    std::sort(found.begin(), found.end(), [](const auto &a, const auto &b)
+              { return a.first > b.first; });
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &[time, entry] : found)
+    {
+        const std::string key = entry.path().stem().string();
+        const uint64_t bytes = entry.file_size(ec);
+        lru.push_back(key);
+        entries.emplace(key, std::make_pair(bytes, std::prev(lru.end())));
+        totalBytes += bytes;
+    }
+    evict();
+    return true;
+}
+
+std::string ResponseCache::key(std::string_view model, std::string_view payload)
+{
+    Sha256 hash;
+    hash.update(model);
+    hash.update(std::string_view("\n", 1));
+    hash.update(payload);
+    return hash.hexDigest();
+}
+
+bool ResponseCache::lookup(const std::string &key, std::string &reply)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (it == entries.end())
+    {
+        metrics().increment("cache.misses");
+        return false;
+    }
+
+    const std::filesystem::path path = pathOf(key);
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        // deleted behind our back
+        totalBytes -= it->second.first;
+        lru.erase(it->second.second);
+        entries.erase(it);
+        metrics().increment("cache.misses");
+        return false;
+    }
+    reply.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    lru.splice(lru.begin(), lru, it->second.second);
+    std::error_code ec;
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+    metrics().increment("cache.hits");
+    return true;
+}
+
+bool ResponseCache::store(const std::string &key, const std::string &reply)
+{
+    // an entry larger than the whole cache would only evict everything else
+    if (reply.size() > maxBytes)
+        return false;
+
+    const std::filesystem::path path = pathOf(key);
+    const std::string tempfile = path.string() + ".tmp";
+    {
+        std::ofstream out(tempfile, std::ios::binary | std::ios::trunc);
+        out.write(reply.data(), static_cast<std::streamsize>(reply.size()));
+        out.close();
+        if (!out)
+        {
+            std::remove(tempfile.c_str());
+            return false;
+        }
+    }
+    // the cache can be rebuilt from the API, so entries are not fsynced
+    if (std::rename(tempfile.c_str(), path.string().c_str()) != 0)
+    {
+        std::remove(tempfile.c_str());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (it != entries.end())
+    {
+        totalBytes -= it->second.first;
+        lru.erase(it->second.second);
+        entries.erase(it);
+    }
+    lru.push_front(key);
+    entries.emplace(key, std::make_pair(static_cast<uint64_t>(reply.size()), lru.begin()));
+    totalBytes += reply.size();
+    metrics().increment("cache.stores");
+    evict();
+    return true;
+}
+
+void ResponseCache::evict()
+{
+    while (totalBytes > maxBytes && !lru.empty())
+    {
+        const std::string &key = lru.back();
+        auto it = entries.find(key);
+        std::error_code ec;
+        std::filesystem::remove(pathOf(key), ec);
+        totalBytes -= it->second.first;
+        entries.erase(it);
+        lru.pop_back();
+        metrics().increment("cache.evictions");
+    }
+}
+
+size_t ResponseCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+uint64_t ResponseCache::bytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return totalBytes;
+}
@@ -0,0 +1,528 @@
+#include "SessionStore.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <nlohmann/json.hpp>
+#include "Timestamp.h"
+#include "FileSync.h"
+#include "BinarySession.h"
+
+static const char *const DEFAULT_SESSION = "default";
+static const char *const DEFAULT_FILE = "chat_history.json";
+static const size_t TITLE_LENGTH = 48;
+
+SessionStore::SessionStore(std::filesystem::path dataDir, size_t residentLimit)
+    : dataDir(std::move(dataDir)), residentLimit(std::max<size_t>(1, residentLimit)),
+      writer([this](const std::string &id, std::string &error)
+             { return saveSession(id, error); }) {}
+
+void SessionStore::setBinarySessions(bool binary)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    sessionExtension = binary ? BINARY_SESSION_EXTENSION : ".json";
+}
+
+void SessionStore::setTailMessages(size_t count)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    tailMessages = count;
+}
+
+void SessionStore::setSessionMemoryLimit(size_t bytes)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    sessionMemoryLimit = bytes;
+}
+
+std::filesystem::path SessionStore::indexPath() const
+{
+    return dataDir / "sessions" / "index.json";
+}
+
+std::string SessionStore::pathOf(const SessionInfo &info) const
+{
+    return (dataDir / info.file).string();
+}
+
+// Most recently modified first
+static std::vector<SessionInfo> sortedSessions(const std::unordered_map<std::string, SessionInfo> &sessions)
+{
+    std::vector<SessionInfo> result;
+    result.reserve(sessions.size());
+    for (const auto &[id, info] : sessions)
+        result.push_back(info);
+    std::sort(result.begin(), result.end(), [](const SessionInfo &a, const SessionInfo &b)
+              { return a.modified != b.modified ? a.modified > b.modified : a.id < b.id; });
+    return result;
+}
+
+static uint64_t fileSize(const std::string &path)
+{
+    std::error_code ec;
+    uint64_t size = std::filesystem::file_size(path, ec);
+    return ec ? 0 : size;
+}
+
+bool SessionStore::readIndex()
+{
+    std::ifstream file(indexPath());
+    if (!file)
+        return false;
+
+    nlohmann::json index = nlohmann::json::parse(file, nullptr, false);
+    if (index.is_discarded() || !index.contains("sessions") || !index["sessions"].is_array())
+    {
+        std::cerr << "Warning: session index " << indexPath() << " is corrupt, rebuilding it.\n";
+        return false;
+    }
+
+    sessions.clear();
+    for (const auto &entry : index["sessions"])
+    {
+        SessionInfo info;
+        info.id = entry.value("id", "");
+        info.title = entry.value("title", "");
+        info.file = entry.value("file", "");
+        info.messages = entry.value("messages", 0);
+        info.modified = entry.value("modified", int64_t(0));
+        info.snapshotBytes = entry.value("snapshot_bytes", uint64_t(0));
+        info.journalBytes = entry.value("journal_bytes", uint64_t(0));
+        if (!info.id.empty() && !info.file.empty())
+            sessions[info.id] = std::move(info);
+    }
+    currentId = index.value("current", DEFAULT_SESSION);
+    nextId = index.value("next_id", uint64_t(1));
+    return true;
+}
+
+std::string SessionStore::indexContents() const
+{
+    std::vector<SessionInfo> entries = sortedSessions(sessions);
+    nlohmann::json array = nlohmann::json::array();
+    for (const SessionInfo &info : entries)
+    {
+        array.push_back({{"id", info.id},
+                         {"title", info.title},
+                         {"file", info.file},
+                         {"messages", info.messages},
+                         {"modified", info.modified},
+                         {"snapshot_bytes", info.snapshotBytes},
+                         {"journal_bytes", info.journalBytes}});
+    }
+    nlohmann::json index = {{"version", 1}, {"current", currentId}, {"next_id", nextId}, {"sessions", array}};
+    return index.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace) + "\n";
+}
+
+bool SessionStore::storeIndex(const std::string &contents, uint64_t version)
+{
+    std::lock_guard<std::mutex> guard(indexMutex);
+    // a newer version was written while this one waited
+    if (version <= indexVersionWritten)
+        return true;
+    // same temporary file + rename dance as the snapshots
+    if (contents != indexWritten && !replaceFile(indexPath().string(), contents))
+        return false;
+    indexVersionWritten = version;
+    indexWritten = contents;
+    return true;
+}
+
+bool SessionStore::writeIndex()
+{
+    return storeIndex(indexContents(), ++indexVersion);
+}
+
+bool SessionStore::open()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    std::error_code ec;
+    std::filesystem::create_directories(dataDir / "sessions", ec);
+    if (ec)
+    {
+        std::cerr << "ERROR: Cannot create session directory: " << ec.message() << "\n";
+        return false;
+    }
+
+    if (!readIndex())
+    {
+        // first run with sessions (or a lost index): adopt the files that are there
+        sessions.clear();
+        SessionInfo defaultSession;
+        defaultSession.id = DEFAULT_SESSION;
+        defaultSession.file = DEFAULT_FILE;
+        sessions[defaultSession.id] = defaultSession;
+
+        for (const auto &entry : std::filesystem::directory_iterator(dataDir / "sessions", ec))
+        {
+            std::string name = entry.path().filename().string();
+            std::string extension = entry.path().extension().string();
+            if (name == "index.json" || (extension != ".json" && extension != ".gcs"))
+                continue;
+            SessionInfo info;
+            info.id = entry.path().stem().string();
+            info.file = (std::filesystem::path("sessions") / name).string();
+            sessions[info.id] = info;
+            if (info.id.size() > 1 && info.id[0] == 's' && std::all_of(info.id.begin() + 1, info.id.end(), ::isdigit))
+                nextId = std::max<uint64_t>(nextId, std::stoull(info.id.substr(1)) + 1);
+        }
+        currentId = DEFAULT_SESSION;
+    }
+
+    if (!sessions.count(currentId))
+        currentId = sessions.count(DEFAULT_SESSION) ? DEFAULT_SESSION : sessions.begin()->first;
+    if (sessions.empty())
+    {
+        SessionInfo defaultSession;
+        defaultSession.id = DEFAULT_SESSION;
+        defaultSession.file = DEFAULT_FILE;
+        sessions[defaultSession.id] = defaultSession;
+        currentId = DEFAULT_SESSION;
+    }
+
+    bool corrupt = false;
+    bool ok = load(currentId, corrupt) != nullptr;
+    // a session that cannot be read right now is tried again when it is next used
+    if (!ok && corrupt)
+        startEmpty(currentId);
+    writeIndex();
+    return ok;
+}
+
+Conversation *SessionStore::load(const std::string &id, bool &corrupt)
+{
+    corrupt = false;
+    auto cached = resident.find(id);
+    if (cached != resident.end())
+    {
+        lru.splice(lru.begin(), lru, cached->second.second);
+        return cached->second.first.get();
+    }
+
+    SessionInfo &info = sessions.at(id);
+    auto convo = std::make_unique<Conversation>();
+    convo->setTailMessages(tailMessages);
+    convo->setMemoryLimit(sessionMemoryLimit, dataDir.string());
+    if (!convo->openSession(pathOf(info), corrupt))
+    {
+        return nullptr;
+    }
+    // the files may have changed after the entry was written (e.g. a crash before the index update)
+    refresh(info, *convo);
+    return makeResident(id, std::move(convo));
+}
+
+// ".unreadable", or ".unreadable.<n>" if an earlier backup of the snapshot or its journal already has that name
+static std::string unreadableSuffix(const std::string &path)
+{
+    std::string suffix = ".unreadable";
+    std::error_code ec;
+    for (int n = 1; std::filesystem::exists(path + suffix, ec) || std::filesystem::exists(path + ".journal" + suffix, ec); ++n)
+        suffix = ".unreadable." + std::to_string(n);
+    return suffix;
+}
+
+Conversation &SessionStore::startEmpty(const std::string &id)
+{
+    // start the session empty, as before sessions existed; the damaged files are moved aside so the
+    // first save does not overwrite them
+    const std::string path = pathOf(sessions.at(id));
+    const std::string suffix = unreadableSuffix(path);
+    std::error_code moveError;
+    for (const std::string &file : {path, path + ".journal"})
+    {
+        std::error_code ec;
+        if (std::filesystem::exists(file, ec))
+            std::filesystem::rename(file, file + suffix, ec);
+        if (ec && !moveError)
+            moveError = ec;
+    }
+    std::cerr << "WARNING: Cannot read session '" << id << "'; starting it empty"
+              << (moveError ? " (could not move the old file aside: " + moveError.message() + ")"
+                            : " (old file kept as " + path + suffix + ")")
+              << "\n";
+
+    auto convo = std::make_unique<Conversation>();
+    convo->setTailMessages(tailMessages);
+    convo->setMemoryLimit(sessionMemoryLimit, dataDir.string());
+    refresh(sessions.at(id), *convo);
+    return *makeResident(id, std::move(convo));
+}
+
+Conversation *SessionStore::makeResident(const std::string &id, std::unique_ptr<Conversation> convo)
+{
+    lru.push_front(id);
+    Conversation *loaded = convo.get();
+    resident.emplace(id, std::make_pair(std::move(convo), lru.begin()));
+
+    // evict from the cold end, never the session just made resident
+    while (resident.size() > residentLimit)
+    {
+        const std::string victim = lru.back();
+        awaitWrite(victim);
+        auto entry = resident.find(victim);
+        SessionInfo &victimInfo = sessions.at(victim);
+        if (!entry->second.first->persist(pathOf(victimInfo)))
+        {
+            std::cerr << "Warning: could not save session " << victim << "; keeping it in memory.\n";
+            break;
+        }
+        refresh(victimInfo, *entry->second.first);
+        lru.pop_back();
+        resident.erase(entry);
+    }
+    return loaded;
+}
+
+void SessionStore::refresh(SessionInfo &info, const Conversation &convo)
+{
+    const std::string path = pathOf(info);
+    info.messages = convo.size();
+    info.snapshotBytes = fileSize(path);
+    info.journalBytes = fileSize(path + ".journal");
+
+    // the first prompt of a lazily opened session is still on disk; it gets its title once fully loaded
+    if (info.title.empty() && !convo.empty() && convo.firstResident() == 0)
+    {
+        // first prompt, on one line and cut at a character boundary
+        std::string title(convo.getMessages().front().content.substr(0, TITLE_LENGTH * 2));
+        std::replace_if(title.begin(), title.end(), [](char c)
+                        { return c == '\n' || c == '\r' || c == '\t'; }, ' ');
+        if (title.size() > TITLE_LENGTH)
+        {
+            size_t cut = TITLE_LENGTH;
+            while (cut > 0 && (static_cast<unsigned char>(title[cut]) & 0xC0) == 0x80)
+                --cut;
+            title = title.substr(0, cut) + "...";
+        }
+        title.erase(title.find_last_not_of(' ') + 1);
+        info.title = title;
+    }
+}
+
+std::string SessionStore::newId()
+{
+    std::string id;
+    do
+    {
+        id = "s" + std::to_string(nextId++);
+    } while (sessions.count(id));
+    return id;
+}
+
+Conversation &SessionStore::require(const std::string &id)
+{
+    bool corrupt = false;
+    if (Conversation *loaded = load(id, corrupt))
+        return *loaded;
+    // never reset a session that was in use: it may only be unreadable for a moment
+    throw std::runtime_error("cannot read session '" + id + "'" + (corrupt ? " (its files are damaged)" : "") +
+                             "; its files are left as they are");
+}
+
+Conversation &SessionStore::current()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return require(currentId);
+}
+
+Conversation &SessionStore::session(const std::string &id)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return require(id);
+}
+
+SessionInfo SessionStore::currentInfo() const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return sessions.at(currentId);
+}
+
+std::string SessionStore::currentPath() const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return pathOf(sessions.at(currentId));
+}
+
+std::unique_lock<std::mutex> SessionStore::lock() const
+{
+    return std::unique_lock<std::mutex>(mutex);
+}
+
+std::vector<SessionInfo> SessionStore::list() const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    std::vector<SessionInfo> result = sortedSessions(sessions);
+    // a resident session may have messages the writer has not saved yet
+    for (SessionInfo &info : result)
+    {
+        auto entry = resident.find(info.id);
+        if (entry != resident.end())
+            info.messages = entry->second.first->size();
+    }
+    return result;
+}
+
+bool SessionStore::isResident(const std::string &id) const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return resident.count(id) > 0;
+}
+
+bool SessionStore::switchTo(const std::string &key)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    std::string id;
+    if (sessions.count(key))
+    {
+        id = key;
+    }
+    else
+    {
+        // unique case-insensitive title prefix
+        auto lower = [](std::string text)
+        {
+            std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+            return text;
+        };
+        const std::string prefix = lower(key);
+        for (const auto &[candidate, info] : sessions)
+        {
+            if (lower(info.title).compare(0, prefix.size(), prefix) != 0)
+                continue;
+            if (!id.empty())
+                return false;
+            id = candidate;
+        }
+    }
+    if (id.empty())
+        return false;
+
+    // the session being left was queued for the writer when it last changed; the index picks up the new
+    // current session with the next save instead of an fsync per switch
+    require(id);
+    currentId = id;
+    return true;
+}
+
+SessionInfo SessionStore::create(const std::string &title)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    SessionInfo info;
+    info.id = newId();
+    info.title = title;
+    info.file = (std::filesystem::path("sessions") / (info.id + sessionExtension)).string();
+    info.modified = currentEpochSeconds();
+    sessions[info.id] = info;
+
+    require(info.id);
+    currentId = info.id;
+    writeIndex();
+    return sessions.at(info.id);
+}
+
+bool SessionStore::import(const std::string &FILENAME)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    auto convo = std::make_unique<Conversation>();
+    convo->setMemoryLimit(sessionMemoryLimit, dataDir.string());
+    if (!convo->loadFromFile(FILENAME))
+        return false;
+
+    SessionInfo info;
+    info.id = newId();
+    info.title = std::filesystem::path(FILENAME).stem().string();
+    // a binary archive stays binary, so reopening it only decodes its tail
+    const bool binary = std::filesystem::path(FILENAME).extension() == BINARY_SESSION_EXTENSION;
+    info.file = (std::filesystem::path("sessions") / (info.id + (binary ? BINARY_SESSION_EXTENSION : sessionExtension))).string();
+    info.modified = currentEpochSeconds();
+    if (!convo->compact(pathOf(info)))
+        return false;
+
+    refresh(info, *convo);
+    sessions[info.id] = info;
+    makeResident(info.id, std::move(convo));
+    currentId = info.id;
+    writeIndex();
+    return true;
+}
+
+void SessionStore::awaitWrite(const std::string &id)
+{
+    writeDone.wait(mutex, [&]
+                   { return saving != id; });
+}
+
+bool SessionStore::saveSession(const std::string &id, std::string &error)
+{
+    std::unique_lock<std::mutex> guard(mutex);
+    // the second attempt rewrites the snapshot: a failed append leaves a possibly torn record behind
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        auto entry = resident.find(id);
+        if (entry == resident.end())
+            return true; // evicted since it was marked, and eviction persists first
+        Conversation::PendingSave save;
+        bool written = false;
+        if (entry->second.first->prepareSave(pathOf(sessions.at(id)), save, attempt > 0))
+        {
+            // turns (and the daemon's other clients) keep using the store while the files are written
+            saving = id;
+            guard.unlock();
+            written = Conversation::writeSave(save);
+            guard.lock();
+            saving.clear();
+            writeDone.notify_all();
+        }
+
+        SessionInfo &info = sessions.at(id);
+        Conversation &convo = *resident.at(id).first;
+        convo.finishSave(save, written);
+        if (!written)
+            continue;
+        if (info.messages != convo.size())
+            info.modified = currentEpochSeconds();
+        refresh(info, convo);
+        const std::string contents = indexContents();
+        const uint64_t version = ++indexVersion;
+        guard.unlock();
+        storeIndex(contents, version);
+        return true;
+    }
+
+    const std::string emergencyFile = (dataDir / "chat_history_backup.json").string();
+    error = "could not write session " + id + " to " + pathOf(sessions.at(id));
+    if (resident.at(id).first->saveToFile(emergencyFile))
+        error += "; emergency backup saved to " + emergencyFile;
+    else
+        error += "; the emergency backup failed as well";
+    return false;
+}
+
+void SessionStore::markDirty()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    writer.markDirty(currentId);
+}
+
+void SessionStore::markDirty(const std::string &id)
+{
+    writer.markDirty(id);
+}
+
+void SessionStore::flush()
+{
+    writer.flush();
+    // a switch since the last save is only in memory so far
+    std::unique_lock<std::mutex> guard(mutex);
+    const std::string contents = indexContents();
+    const uint64_t version = ++indexVersion;
+    guard.unlock();
+    storeIndex(contents, version);
+}
+
+std::vector<std::string> SessionStore::takeSaveErrors()
+{
+    return writer.takeErrors();
+}
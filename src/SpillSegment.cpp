@@ -0,0 +1,65 @@
+#include "SpillSegment.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+SpillSegment::~SpillSegment()
+{
+    for (const auto &[address, size] : mappings)
+        munmap(address, size);
+    if (fd >= 0)
+        ::close(fd);
+}
+
+bool SpillSegment::open(const std::string &dir, std::string &error)
+{
+    std::string path = (dir.empty() ? std::string(".") : dir) + "/spill-XXXXXX";
+    fd = mkstemp(path.data());
+    if (fd < 0)
+    {
+        error = "cannot create a spill file in " + dir + ": " + std::strerror(errno);
+        return false;
+    }
+    // only the descriptor keeps the data alive
+    ::unlink(path.c_str());
+    return true;
+}
+
+const char *SpillSegment::append(const std::string &data, std::string &error)
+{
+    if (data.empty())
+        return "";
+
+    // mappings start on a page boundary
+    const uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    const uint64_t offset = (length + page - 1) / page * page;
+    for (size_t written = 0; written < data.size();)
+    {
+        ssize_t n = pwrite(fd, data.data() + written, data.size() - written, static_cast<off_t>(offset + written));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            error = std::string("cannot write the spill file: ") + std::strerror(errno);
+            return nullptr;
+        }
+        written += static_cast<size_t>(n);
+    }
+
+    void *address = mmap(nullptr, data.size(), PROT_READ, MAP_SHARED, fd, static_cast<off_t>(offset));
+    if (address == MAP_FAILED)
+    {
+        error = std::string("cannot map the spill file: ") + std::strerror(errno);
+        return nullptr;
+    }
+    mappings.emplace_back(address, data.size());
+    length = offset + data.size();
+    return static_cast<const char *>(address);
+}
+
+uint64_t SpillSegment::bytes() const
+{
+    return length;
+}
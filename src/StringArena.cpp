@@ -0,0 +1,69 @@
+#include "StringArena.h"
+#include <cstring>
+#include <iterator>
+
+StringArena::StringArena(size_t chunkSize) : chunkSize(chunkSize) {}
+
+std::string_view StringArena::store(std::string_view text)
+{
+    if (text.empty())
+        return std::string_view();
+
+    if (chunks.empty() || chunks.back().capacity - chunks.back().used < text.size())
+    {
+        // oversized strings get a dedicated chunk so the current chunk keeps filling up
+        size_t capacity = text.size() > chunkSize / 4 ? text.size() : chunkSize;
+        Chunk chunk;
+        chunk.data.reset(new char[capacity]);
+        chunk.capacity = capacity;
+        bytesReserved += capacity;
+
+        if (capacity != chunkSize && !chunks.empty())
+        {
+            // insert before the partially filled chunk so it stays the active one
+            chunks.insert(chunks.end() - 1, std::move(chunk));
+            Chunk &dedicated = chunks[chunks.size() - 2];
+            std::memcpy(dedicated.data.get(), text.data(), text.size());
+            dedicated.used = text.size();
+            bytesUsed += text.size();
+            return std::string_view(dedicated.data.get(), text.size());
+        }
+        chunks.push_back(std::move(chunk));
+    }
+
+    Chunk &chunk = chunks.back();
+    char *dest = chunk.data.get() + chunk.used;
+    std::memcpy(dest, text.data(), text.size());
+    chunk.used += text.size();
+    bytesUsed += text.size();
+    return std::string_view(dest, text.size());
+}
+
+void StringArena::adopt(StringArena &&other)
+{
+    // the chunk records move, their buffers do not; the active chunk stays last
+    auto at = chunks.empty() ? chunks.end() : chunks.end() - 1;
+    chunks.insert(at, std::make_move_iterator(other.chunks.begin()), std::make_move_iterator(other.chunks.end()));
+    bytesUsed += other.bytesUsed;
+    bytesReserved += other.bytesReserved;
+    other.chunks.clear();
+    other.bytesUsed = 0;
+    other.bytesReserved = 0;
+}
+
+void StringArena::clear()
+{
+    chunks.clear();
+    bytesUsed = 0;
+    bytesReserved = 0;
+}
+
+size_t StringArena::used() const
+{
+    return bytesUsed;
+}
+
+size_t StringArena::reserved() const
+{
+    return bytesReserved;
+}
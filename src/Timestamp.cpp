@@ -0,0 +1,53 @@
+#include "Timestamp.h"
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+
+int64_t currentEpochSeconds()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+// Formating the timestamp as "YYYY-MM-DD HH:MM:SS"
+std::string formatTimestamp(int64_t epochSeconds)
+{
+    std::time_t time = static_cast<std::time_t>(epochSeconds);
+    std::tm local_tm;
+#if defined(_POSIX_VERSION) || defined(__linux__)
+    localtime_r(&time, &local_tm);
+#else
+    const std::tm *tmp = std::localtime(&time);
+    if (tmp)
+        local_tm = *tmp;
+#endif
+    char buffer[20];
+    std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &local_tm);
+    return std::string(buffer);
+}
+
+bool parseTimestamp(std::string_view text, int64_t &epochSeconds)
+{
+    if (text.size() != 19)
+        return false;
+
+    char buffer[20];
+    text.copy(buffer, text.size());
+    buffer[19] = '\0';
+
+    std::tm local_tm{};
+    char tail;
+    if (std::sscanf(buffer, "%4d-%2d-%2d %2d:%2d:%2d%c", &local_tm.tm_year, &local_tm.tm_mon, &local_tm.tm_mday,
+                    &local_tm.tm_hour, &local_tm.tm_min, &local_tm.tm_sec, &tail) != 6)
+        return false;
+
+    local_tm.tm_year -= 1900;
+    local_tm.tm_mon -= 1;
+    local_tm.tm_isdst = -1;
+    std::time_t time = std::mktime(&local_tm);
+    if (time == static_cast<std::time_t>(-1))
+        return false;
+    epochSeconds = static_cast<int64_t>(time);
+    return true;
+}
@@ -2,38 +2,239 @@
 #include <filesystem>
 #include <cstdlib>
 #include <memory>
-#include <thread>
 #include <chrono>
+#include <atomic>
+#include <mutex>
+#include <csignal>
+#include <poll.h>
+#include <unistd.h>
 #include <nlohmann/json.hpp>
 
 #include "Conversation.h"
 #include "GeminiClient.h"
 #include "CLIHandler.h"
+#include "SessionStore.h"
 #include "EnvHandler.h"
+#include "ContextWindow.h"
+#include "Metrics.h"
+#include "BatchRunner.h"
+#include "Daemon.h"
 
-// Conversation* g_convo = nullptr;
-// std::string g_chatFile;
+// Set by Ctrl-C: cancels the request in flight, or saves and exits at the prompt
+static volatile std::sig_atomic_t g_interrupted = 0;
 
-// void handleExitSignal(int)
-// {
-//     if (g_convo)
-//     {
-//         g_convo->saveToFile(g_chatFile);
-//     }
+static void handleInterrupt(int)
+{
+    g_interrupted = 1;
+}
+
+// Installed without SA_RESTART so a blocking read at the prompt returns on Ctrl-C
+static void installInterruptHandler()
+{
+    struct sigaction action = {};
+    action.sa_handler = handleInterrupt;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = 0;
+    sigaction(SIGINT, &action, nullptr);
+}
+
+// Wait for a reply on the background worker while showing progress.
+// Ctrl-C or a "/cancel" line typed meanwhile cancels the request; get() then throws RequestCancelled.
+static std::string awaitReply(PendingReply &reply, const std::atomic<bool> &firstChunk, std::mutex &outputMutex, bool showProgress)
+{
+    const auto started = std::chrono::steady_clock::now();
+    long shownSeconds = -1;
+    // piped input is left for the prompt; only an interactive terminal is read for /cancel
+    bool stdinOpen = isatty(STDIN_FILENO);
+
+    while (!reply.waitFor(std::chrono::milliseconds(100)))
+    {
+        if (g_interrupted)
+        {
+            g_interrupted = 0;
+            reply.cancel();
+        }
+
+        if (stdinOpen)
+        {
+            struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+            if (poll(&pfd, 1, 0) > 0)
+            {
+                std::string line;
+                if (!std::getline(std::cin, line))
+                {
+                    std::cin.clear();
+                    stdinOpen = false;
+                }
+                else if (line.find("/cancel") != std::string::npos)
+                {
+                    reply.cancel();
+                }
+                else
+                {
+                    std::lock_guard<std::mutex> lock(outputMutex);
+                    std::cerr << "A request is in progress; type /cancel or press Ctrl-C to abort it.\n";
+                }
+            }
+        }
 
-//     std::_Exit(0);
-// }
+        long seconds = static_cast<long>(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - started).count());
+        if (showProgress && !firstChunk && seconds != shownSeconds)
+        {
+            std::lock_guard<std::mutex> lock(outputMutex);
+            if (!firstChunk)
+            {
+                std::cout << "\r\033[KGemini: waiting " << seconds << "s, " << reply.bytesReceived() << " bytes";
+                if (int retries = reply.retries())
+                    std::cout << ", retry " << retries;
+                std::cout << " (/cancel or Ctrl-C to abort)" << std::flush;
+            }
+            shownSeconds = seconds;
+        }
+    }
+
+    if (showProgress && !firstChunk)
+    {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cout << "\r\033[K" << std::flush;
+    }
+    return reply.get();
+}
+
+// Print the save failures the writer thread reported since the last prompt
+static void reportSaveErrors(SessionStore &store)
+{
+    std::vector<std::string> errors = store.takeSaveErrors();
+    if (errors.empty())
+        return;
 
+    std::cerr << "\nERROR: Failed to save chat history.\n";
+    for (const std::string &error : errors)
+        std::cerr << "  " << error << "\n";
+    std::cerr << "Your recent messages may not be permanently saved.\n"
+              << "Possible causes:\n"
+              << "  - Disk is full\n"
+              << "  - Permission denied\n"
+              << "  - File system error\n"
+              << "Please free disk space or fix permissions.\n";
+}
 
-int main()
+// Context budget: GEMINI_CONTEXT_POLICY = all | window | pin | summary | relevance, GEMINI_CONTEXT_TOKENS,
+// GEMINI_CONTEXT_PIN, GEMINI_CONTEXT_TOPK / GEMINI_CONTEXT_RECENT (relevance)
+static std::unique_ptr<ContextPolicy> contextPolicyFromEnv(size_t &contextBudget)
+{
+    const char *envPolicy = std::getenv("GEMINI_CONTEXT_POLICY");
+    const char *envBudget = std::getenv("GEMINI_CONTEXT_TOKENS");
+    const char *envPin = std::getenv("GEMINI_CONTEXT_PIN");
+    const char *envTopK = std::getenv("GEMINI_CONTEXT_TOPK");
+    const char *envRecent = std::getenv("GEMINI_CONTEXT_RECENT");
+    contextBudget = envBudget ? std::strtoull(envBudget, nullptr, 10) : 100000;
+    std::unique_ptr<ContextPolicy> contextPolicy =
+        makeContextPolicy(envPolicy ? envPolicy : "window", envPin ? std::strtoull(envPin, nullptr, 10) : 2,
+                          envTopK ? std::strtoull(envTopK, nullptr, 10) : 6,
+                          envRecent ? std::strtoull(envRecent, nullptr, 10) : 6);
+    if (!contextPolicy)
+    {
+        std::cerr << "Warning: unknown GEMINI_CONTEXT_POLICY '" << envPolicy << "', using window.\n";
+        contextPolicy = std::make_unique<SlidingWindowPolicy>();
+    }
+    return contextPolicy;
+}
+
+static void printUsage(const char *program)
+{
+    std::cerr << "Usage: " << program << "                 interactive chat\n"
+              << "       " << program << " --batch <prompts.jsonl> [--out <replies.jsonl>] [--concurrency N]\n"
+              << "       " << program << " --daemon [--socket <path>]   serve sessions to attached clients\n"
+              << "       " << program << " --attach [--socket <path>]   chat through a running daemon\n";
+}
+
+// Non-interactive mode: prompts from a JSONL file, replies as JSONL (see BatchRunner.h)
+static int runBatchMode(int argc, char **argv)
+{
+    BatchOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--batch" && i + 1 < argc)
+        {
+            options.inputFile = argv[++i];
+        }
+        else if (arg == "--out" && i + 1 < argc)
+        {
+            options.outputFile = argv[++i];
+        }
+        else if (arg == "--concurrency" && i + 1 < argc)
+        {
+            options.concurrency = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (options.inputFile.empty())
+    {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::unique_ptr<ContextPolicy> contextPolicy = contextPolicyFromEnv(options.contextBudget);
+    options.policy = contextPolicy.get();
+
+    try
+    {
+        GeminiClient client;
+        if (!client.isConfigured())
+        {
+            std::cerr << "Error: GEMINI_API_KEY is not set.\n";
+            return EXIT_FAILURE;
+        }
+        int failed = runBatch(client, options);
+        if (const char *envMetricsFile = std::getenv("GEMINI_METRICS_FILE"))
+            metrics().writeToFile(envMetricsFile);
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+}
+
+int main(int argc, char **argv)
 {
     loadEnvFile(".env");
 
-    Conversation convo;
+    // --daemon serves the sessions below over a socket, --attach talks to such a daemon
+    std::string daemonSocket;
+    if (argc > 1 && (std::string(argv[1]) == "--daemon" || std::string(argv[1]) == "--attach"))
+    {
+        std::string socketPath = defaultDaemonSocket();
+        if (argc == 4 && std::string(argv[2]) == "--socket")
+        {
+            socketPath = argv[3];
+        }
+        else if (argc != 2)
+        {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (std::string(argv[1]) == "--attach")
+        {
+            return runDaemonClient(socketPath);
+        }
+        daemonSocket = socketPath;
+    }
+    else if (argc > 1)
+    {
+        return runBatchMode(argc, argv);
+    }
+
     std::unique_ptr<GeminiClient> client;
     bool shouldExit = false;
     const std::filesystem::path dataDir = "./data";
-    const std::filesystem::path chatFile = dataDir / "chat_history.json";
 
     std::error_code ec;
 
@@ -47,29 +248,79 @@ int main()
         }
     }
 
-    if (std::filesystem::exists(chatFile))
+    // sessions under ./data; the last used one is loaded (snapshot + journal replay)
+    const char *envSessionCache = std::getenv("GEMINI_SESSION_CACHE");
+    SessionStore store(dataDir, envSessionCache ? std::strtoull(envSessionCache, nullptr, 10) : 16);
+    // binary sessions open with only their recent tail decoded
+    const char *envSessionFormat = std::getenv("GEMINI_SESSION_FORMAT");
+    store.setBinarySessions(envSessionFormat && std::string(envSessionFormat) == "gcs");
+    if (const char *envHistoryTail = std::getenv("GEMINI_HISTORY_TAIL"))
+        store.setTailMessages(std::strtoull(envHistoryTail, nullptr, 10));
+    // older message text of a long session moves to a spill file under ./data
+    if (const char *envSessionMemory = std::getenv("GEMINI_SESSION_MEMORY_MB"))
+        store.setSessionMemoryLimit(std::strtoull(envSessionMemory, nullptr, 10) * 1024 * 1024);
+    if (!store.open())
     {
-        if (!convo.loadFromFile(chatFile.string()))
-        {
-            std::cerr << "WARNING: Failed to load chat history.\n";
-        }
+        std::cerr << "WARNING: Failed to load chat history.\n";
     }
 
-    // globalConvo = &convo;
-    // globalChatFile = chatFile;
+    installInterruptHandler();
+    const bool showProgress = isatty(STDOUT_FILENO);
 
-    // std::signal(SIGINT, handleExitSignal);
-    // std::signal(SIGTERM, handleExitSignal);
+    // replies are streamed token by token unless GEMINI_STREAM=0
+    const char *envStream = std::getenv("GEMINI_STREAM");
+    const bool streamReplies = !(envStream && std::string(envStream) == "0");
+
+    size_t contextBudget = 0;
+    std::unique_ptr<ContextPolicy> contextPolicy = contextPolicyFromEnv(contextBudget);
+
+    // optional JSON metrics dump for monitoring, rewritten after every turn
+    const char *envMetricsFile = std::getenv("GEMINI_METRICS_FILE");
+
+    if (!daemonSocket.empty())
+    {
+        DaemonOptions options;
+        options.socketPath = daemonSocket;
+        options.policy = contextPolicy.get();
+        options.contextBudget = contextBudget;
+        options.streamReplies = streamReplies;
+        options.metricsFile = envMetricsFile ? envMetricsFile : "";
+        try
+        {
+            // one client and its connection pool serve every attached terminal
+            GeminiClient daemonClient;
+            if (!daemonClient.isConfigured())
+                std::cerr << "Warning: GEMINI_API_KEY not set. Gemini requests will be disabled.\n";
+            return runDaemon(store, daemonClient, options);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Error: " << e.what() << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+    auto dumpMetrics = [envMetricsFile]()
+    {
+        if (envMetricsFile && !metrics().writeToFile(envMetricsFile))
+            std::cerr << "Warning: failed to write metrics to " << envMetricsFile << "\n";
+    };
 
     std::string input;
-    std::cout << "Commands: /new, /load <file>, /export <file>, /exit\n";
+    std::cout << "Session: " << store.currentInfo().id << ". Commands: /new, /sessions, /switch <id>, /load <file>, /export <file>, /help, /exit\n";
 
     while (!shouldExit)
     {
-        std::cout << "\nYou: ";
-        std::getline(std::cin, input);
+        reportSaveErrors(store);
+        std::cout << "\nYou: " << std::flush;
+        g_interrupted = 0;
+        if (!std::getline(std::cin, input))
+        {
+            // Ctrl-C at the prompt or end of input: save and leave
+            std::cout << "\nSaving conversation and exiting.\n";
+            break;
+        }
 
-        if (handleCommand(input, convo, shouldExit))
+        if (handleCommand(input, store, shouldExit))
         {
             continue;
         }
@@ -82,7 +333,23 @@ int main()
         // string validation for input can be added here if needed (e.g., check for max length, prohibited content, etc.)
         input.erase(0, input.find_first_not_of(" \t\n\r"));
         input.erase(input.find_last_not_of(" \t\n\r") + 1);
-        convo.addMessage(Role::user, input);
+        Conversation *session = nullptr;
+        try
+        {
+            session = &store.current();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Error: " << e.what() << "\n";
+            continue;
+        }
+        Conversation &convo = *session;
+        ScopedTimer turnTimer("turn.total");
+        metrics().increment("turns");
+        {
+            auto lock = store.lock();
+            convo.addMessage(Role::user, input);
+        }
 
         // Ensure Gemini client available
         if (!client)
@@ -106,61 +373,82 @@ int main()
         if (!client)
         {
             std::cerr << "Gemini client unavailable; skipping request.\n";
+            // the prompt stays in the history like that of a failed request
+            store.markDirty();
             continue;
         }
 
         try
         {
-            nlohmann::json geminiInput =  convo.toGeminiFormat();
-            // std::cout<< "Gemini input JSON: " << geminiInput.dump(2) << "\n"; // Debugging output
-            std::string response = client->sendMessage(geminiInput);
-            // std::cout<< "Raw Gemini response: " << response << "\n"; // Debugging output
-            std::string reply = client->extractGeminiReply(response);
-            std::cout << "Gemini: " << reply << "\n";
-            convo.addMessage(Role::model, reply);
-
-            bool saveOk = convo.saveToFile(chatFile.string());
-
-            if (!saveOk)
+            // request body assembled from the cached serialized entries the policy selected
+            ScopedTimer selectTimer("turn.context");
+            // selecting may index new messages or read older ones from disk, which the writer thread also does
+            // when compacting
+            auto selectLock = store.lock();
+            ContextSelection context = contextPolicy->select(convo, contextBudget);
+            selectTimer.stop();
+            ScopedTimer payloadTimer("turn.payload");
+            std::string geminiInput = convo.toGeminiPayload(context);
+            payloadTimer.stop();
+            selectLock.unlock();
+            // std::cout<< "Gemini input JSON: " << geminiInput << "\n"; // Debugging output
+            // the request runs on the client's worker thread so it can be cancelled while we wait
+            std::mutex outputMutex;
+            std::atomic<bool> firstChunk{false};
+            GeminiClient::ChunkCallback onChunk;
+            if (streamReplies)
             {
-                std::cerr << "\nERROR: Failed to save chat history.\n"
-                          << "Your recent messages may not be permanently saved.\n"
-                          << "Possible causes:\n"
-                          << "  - Disk is full\n"
-                          << "  - Permission denied\n"
-                          << "  - File system error\n"
-                          << "\nAttempting recovery...\n";
-
-                // Retry once after short delay
-                std::this_thread::sleep_for(std::chrono::milliseconds(200));
-
-                saveOk = convo.saveToFile(chatFile.string());
-
-                if (!saveOk)
+                onChunk = [&](const std::string &chunk)
                 {
-                    std::cerr << "\nCRITICAL: Unable to save chat history after retry.\n"
-                              << "Please free disk space or fix permissions.\n"
-                              << "You may lose recent conversation state if program exits.\n";
-
-                    // Optional: emergency backup attempt
-                    std::string emergencyFile = "./data/chat_history_backup.json";
-
-                    if (convo.saveToFile(emergencyFile))
-                    {
-                        std::cerr << "Emergency backup saved to: "
-                                  << emergencyFile << "\n";
-                    }
-                    else
-                    {
-                        std::cerr << "Emergency backup also failed.\n";
-                    }
-                }
+                    std::lock_guard<std::mutex> lock(outputMutex);
+                    if (!firstChunk.exchange(true))
+                        std::cout << (showProgress ? "\r\033[K" : "") << "Gemini: ";
+                    std::cout << chunk << std::flush;
+                };
+            }
+            ScopedTimer waitTimer("turn.wait");
+            std::unique_ptr<PendingReply> pending = client->start(std::move(geminiInput), onChunk);
+            std::string reply = awaitReply(*pending, firstChunk, outputMutex, showProgress);
+            waitTimer.stop();
+            if (streamReplies)
+            {
+                if (!firstChunk)
+                    std::cout << "Gemini: ";
+                std::cout << "\n";
+            }
+            else
+            {
+                std::cout << "Gemini: " << reply << "\n";
+            }
+            {
+                auto lock = store.lock();
+                convo.addMessage(Role::model, reply);
             }
 
+            // fold messages that fell out of the window into the summary, for the next turns
+            if (context.unsummarized > 0)
+                foldIntoSummary(*client, store, convo, context.unsummarized);
+
+        }
+        catch (const RequestCancelled &)
+        {
+            metrics().increment("turns.cancelled");
+            std::cout << "\n[cancelled] The request was aborted; your message is kept in the history.\n";
         }
         catch (const std::exception &e)
         {
-            std::cerr << "Error: " << e.what() << "\n";
+            metrics().increment("turns.failed");
+            std::cerr << "\nError: " << e.what() << "\n";
         }
+
+        // saved after every turn, including cancelled and failed requests, by the writer thread
+        store.markDirty();
+        turnTimer.stop();
+        dumpMetrics();
     }
+    // a last save covers turns that skipped the request; flush waits for the writer to finish
+    store.markDirty();
+    store.flush();
+    reportSaveErrors(store);
+    dumpMetrics();
 }
\ No newline at end of file
@@ -0,0 +1,429 @@
+// mock_gemini - local stand-in for the Gemini REST API, for load tests and offline runs
+// Usage: mock_gemini [--port 18080] [--latency-ms 50] [--jitter-ms 0] [--slow-rate 0] [--slow-ms 2000]
+//                    [--reply-bytes 0] [--chunks 8] [--chunk-delay-ms 10] [--error-rate 0] [--rate-limit-rate 0]
+//                    [--retry-delay-ms 1000] [--reject-gzip] [--seed 1]
+// Serves POST .../models/<model>:generateContent and :streamGenerateContent?alt=sse over HTTP/1.1 keep-alive,
+// one thread per connection. Each request waits latency + uniform(0, jitter) ms before the first byte, and a
+// --slow-rate fraction of them --slow-ms more (the long tail hedged requests are meant for). A streamed reply
+// is then split into --chunks SSE events --chunk-delay-ms apart. The reply is "echo <contents>: <last prompt>",
+// padded with filler words to --reply-bytes when that is larger.
+// --error-rate and --rate-limit-rate are the fractions of requests answered at once with 503 UNAVAILABLE and
+// 429 RESOURCE_EXHAUSTED (with a RetryInfo of --retry-delay-ms). gzip request bodies are accepted, or with
+// --reject-gzip answered with 415 like an endpoint that does not take compressed requests.
+// Point the client at it with GEMINI_BASE_URL=http://127.0.0.1:<port>/v1beta; the port is printed on stdout.
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <nlohmann/json.hpp>
+
+#include "Gzip.h"
+
+struct MockOptions
+{
+    int port = 18080;
+    long latencyMs = 50;
+    long jitterMs = 0;
+    double slowRate = 0;
+    long slowMs = 2000;
+    size_t replyBytes = 0;
+    size_t chunks = 8;
+    long chunkDelayMs = 10;
+    double errorRate = 0;
+    double rateLimitRate = 0;
+    long retryDelayMs = 1000;
+    bool rejectGzip = false;
+    unsigned seed = 1;
+};
+
+static MockOptions options;
+static std::atomic<unsigned> connectionCount{0};
+
+static const char *const FILLER[] = {"lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+                                     "elit", "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore"};
+
+struct MockRequest
+{
+    std::string method;
+    std::string target;
+    // header names in lower case
+    std::map<std::string, std::string> headers;
+    std::string body;
+};
+
+static bool sendAll(int fd, const std::string &data)
+{
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Buffered reader over one connection; bytes past the current request stay for the next one
+class Connection
+{
+private:
+    int fd;
+    std::string buffer;
+
+    bool fill()
+    {
+        char chunk[16384];
+        ssize_t n;
+        do
+            n = ::recv(fd, chunk, sizeof(chunk), 0);
+        while (n < 0 && errno == EINTR);
+        if (n <= 0)
+            return false;
+        buffer.append(chunk, static_cast<size_t>(n));
+        return true;
+    }
+
+    bool readLine(std::string &line)
+    {
+        size_t end;
+        while ((end = buffer.find("\r\n")) == std::string::npos)
+        {
+            if (!fill())
+                return false;
+        }
+        line = buffer.substr(0, end);
+        buffer.erase(0, end + 2);
+        return true;
+    }
+
+    bool readBytes(size_t count, std::string &out)
+    {
+        while (buffer.size() < count)
+        {
+            if (!fill())
+                return false;
+        }
+        out.append(buffer, 0, count);
+        buffer.erase(0, count);
+        return true;
+    }
+
+public:
+    explicit Connection(int fd) : fd(fd) {}
+
+    // Read the next request; false when the peer closed the connection or sent something unusable
+    bool readRequest(MockRequest &request)
+    {
+        std::string line;
+        if (!readLine(line))
+            return false;
+        size_t space = line.find(' ');
+        size_t space2 = line.find(' ', space + 1);
+        if (space == std::string::npos || space2 == std::string::npos)
+            return false;
+        request.method = line.substr(0, space);
+        request.target = line.substr(space + 1, space2 - space - 1);
+
+        request.headers.clear();
+        while (readLine(line) && !line.empty())
+        {
+            size_t colon = line.find(':');
+            if (colon == std::string::npos)
+                continue;
+            std::string name = line.substr(0, colon);
+            std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c)
+                           { return static_cast<char>(std::tolower(c)); });
+            size_t value = line.find_first_not_of(' ', colon + 1);
+            request.headers[name] = value == std::string::npos ? "" : line.substr(value);
+        }
+
+        auto expect = request.headers.find("expect");
+        if (expect != request.headers.end() && expect->second == "100-continue" &&
+            !sendAll(fd, "HTTP/1.1 100 Continue\r\n\r\n"))
+            return false;
+
+        request.body.clear();
+        auto encoding = request.headers.find("transfer-encoding");
+        if (encoding != request.headers.end() && encoding->second == "chunked")
+        {
+            for (;;)
+            {
+                if (!readLine(line))
+                    return false;
+                size_t size = std::strtoul(line.c_str(), nullptr, 16);
+                if (size == 0)
+                    return readLine(line);
+                if (!readBytes(size, request.body) || !readLine(line))
+                    return false;
+            }
+        }
+        auto length = request.headers.find("content-length");
+        if (length != request.headers.end())
+            return readBytes(std::strtoull(length->second.c_str(), nullptr, 10), request.body);
+        return true;
+    }
+};
+
+static std::string reasonPhrase(int status)
+{
+    switch (status)
+    {
+    case 200:
+        return "OK";
+    case 400:
+        return "Bad Request";
+    case 404:
+        return "Not Found";
+    case 415:
+        return "Unsupported Media Type";
+    case 429:
+        return "Too Many Requests";
+    default:
+        return "Service Unavailable";
+    }
+}
+
+static bool sendResponse(int fd, int status, const std::string &body)
+{
+    std::string response = "HTTP/1.1 " + std::to_string(status) + " " + reasonPhrase(status) +
+                           "\r\nContent-Type: application/json; charset=UTF-8\r\nContent-Length: " +
+                           std::to_string(body.size()) + "\r\n\r\n";
+    response += body;
+    return sendAll(fd, response);
+}
+
+// Error object in the shape the API uses ({"error": {"code", "message", "status", "details"}})
+static bool sendError(int fd, int status, const std::string &statusName, const std::string &message,
+                      long retryDelayMs = 0)
+{
+    nlohmann::json error = {{"code", status}, {"message", message}, {"status", statusName}};
+    if (retryDelayMs > 0)
+    {
+        char delay[32];
+        std::snprintf(delay, sizeof(delay), "%.3fs", retryDelayMs / 1000.0);
+        error["details"] = nlohmann::json::array(
+            {{{"@type", "type.googleapis.com/google.rpc.RetryInfo"}, {"retryDelay", delay}}});
+    }
+    return sendResponse(fd, status, nlohmann::json{{"error", error}}.dump());
+}
+
+static std::string makeReply(const nlohmann::json &request)
+{
+    const nlohmann::json &contents = request["contents"];
+    std::string prompt;
+    if (!contents.empty())
+    {
+        const nlohmann::json &parts = contents.back().value("parts", nlohmann::json::array());
+        if (!parts.empty() && parts[0].contains("text") && parts[0]["text"].is_string())
+            prompt = parts[0]["text"].get<std::string>();
+    }
+
+    std::string reply = "echo " + std::to_string(contents.size()) + ": " + prompt;
+    for (size_t i = 0; reply.size() < options.replyBytes; ++i)
+    {
+        reply += ' ';
+        reply += FILLER[i % (sizeof(FILLER) / sizeof(FILLER[0]))];
+    }
+    return reply;
+}
+
+static nlohmann::json candidate(const std::string &text, bool last)
+{
+    nlohmann::json c = {{"content", {{"parts", nlohmann::json::array({{{"text", text}}})}, {"role", "model"}}},
+                        {"index", 0}};
+    if (last)
+        c["finishReason"] = "STOP";
+    return c;
+}
+
+static nlohmann::json usage(size_t requestBytes, size_t replyBytes)
+{
+    // roughly four bytes per token, like ContextWindow's estimate
+    return {{"promptTokenCount", requestBytes / 4},
+            {"candidatesTokenCount", replyBytes / 4},
+            {"totalTokenCount", (requestBytes + replyBytes) / 4}};
+}
+
+static bool sendStream(int fd, const std::string &reply, size_t requestBytes)
+{
+    if (!sendAll(fd, "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nTransfer-Encoding: chunked\r\n\r\n"))
+        return false;
+
+    const size_t pieces = std::max<size_t>(1, std::min(options.chunks, reply.size()));
+    const size_t step = (reply.size() + pieces - 1) / pieces;
+    for (size_t offset = 0; offset < reply.size() || offset == 0; offset += step)
+    {
+        const bool last = offset + step >= reply.size();
+        nlohmann::json event = {{"candidates", nlohmann::json::array({candidate(reply.substr(offset, step), last)})}};
+        if (last)
+            event["usageMetadata"] = usage(requestBytes, reply.size());
+        const std::string data = "data: " + event.dump() + "\r\n\r\n";
+
+        char size[32];
+        std::snprintf(size, sizeof(size), "%zx\r\n", data.size());
+        if (!sendAll(fd, size + data + "\r\n"))
+            return false;
+        if (last)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(options.chunkDelayMs));
+    }
+    return sendAll(fd, "0\r\n\r\n");
+}
+
+static bool handle(int fd, const MockRequest &request, std::mt19937 &rng)
+{
+    const bool stream = request.target.find(":streamGenerateContent") != std::string::npos;
+    if (request.method != "POST" || (!stream && request.target.find(":generateContent") == std::string::npos))
+        return sendError(fd, 404, "NOT_FOUND", "unknown method " + request.method + " " + request.target);
+
+    std::string body = request.body;
+    auto encoding = request.headers.find("content-encoding");
+    if (encoding != request.headers.end() && encoding->second == "gzip")
+    {
+        if (options.rejectGzip)
+            return sendError(fd, 415, "INVALID_ARGUMENT", "Content-Encoding gzip is not supported");
+        std::string decoded;
+        if (!gzipDecompress(body, decoded))
+            return sendError(fd, 415, "INVALID_ARGUMENT", "cannot decode gzip request body");
+        body.swap(decoded);
+    }
+
+    nlohmann::json parsed = nlohmann::json::parse(body, nullptr, false);
+    if (parsed.is_discarded() || !parsed.contains("contents") || !parsed["contents"].is_array())
+        return sendError(fd, 400, "INVALID_ARGUMENT", "request body must be JSON with a contents array");
+
+    // failures are answered at once, like a quota check in front of the model
+    const double roll = std::uniform_real_distribution<double>(0, 1)(rng);
+    if (roll < options.rateLimitRate)
+        return sendError(fd, 429, "RESOURCE_EXHAUSTED", "mock rate limit", options.retryDelayMs);
+    if (roll < options.rateLimitRate + options.errorRate)
+        return sendError(fd, 503, "UNAVAILABLE", "mock overload");
+
+    long delay = options.latencyMs;
+    if (options.jitterMs > 0)
+        delay += std::uniform_int_distribution<long>(0, options.jitterMs)(rng);
+    if (std::uniform_real_distribution<double>(0, 1)(rng) < options.slowRate)
+        delay += options.slowMs;
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+
+    const std::string reply = makeReply(parsed);
+    if (stream)
+        return sendStream(fd, reply, body.size());
+
+    nlohmann::json response = {{"candidates", nlohmann::json::array({candidate(reply, true)})},
+                               {"usageMetadata", usage(body.size(), reply.size())}};
+    return sendResponse(fd, 200, response.dump());
+}
+
+static void serve(int fd)
+{
+    const unsigned id = ++connectionCount;
+    std::mt19937 rng(options.seed * 7919u + id);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    Connection connection(fd);
+    MockRequest request;
+    while (connection.readRequest(request))
+    {
+        if (!handle(fd, request, rng))
+            break;
+        auto close = request.headers.find("connection");
+        if (close != request.headers.end() && close->second == "close")
+            break;
+    }
+    ::close(fd);
+}
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (arg == "--port" && value)
+            options.port = std::atoi(argv[++i]);
+        else if (arg == "--latency-ms" && value)
+            options.latencyMs = std::atol(argv[++i]);
+        else if (arg == "--jitter-ms" && value)
+            options.jitterMs = std::atol(argv[++i]);
+        else if (arg == "--slow-rate" && value)
+            options.slowRate = std::atof(argv[++i]);
+        else if (arg == "--slow-ms" && value)
+            options.slowMs = std::atol(argv[++i]);
+        else if (arg == "--reply-bytes" && value)
+            options.replyBytes = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--chunks" && value)
+            options.chunks = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--chunk-delay-ms" && value)
+            options.chunkDelayMs = std::atol(argv[++i]);
+        else if (arg == "--error-rate" && value)
+            options.errorRate = std::atof(argv[++i]);
+        else if (arg == "--rate-limit-rate" && value)
+            options.rateLimitRate = std::atof(argv[++i]);
+        else if (arg == "--retry-delay-ms" && value)
+            options.retryDelayMs = std::atol(argv[++i]);
+        else if (arg == "--reject-gzip")
+            options.rejectGzip = true;
+        else if (arg == "--seed" && value)
+            options.seed = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else
+        {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--port 18080] [--latency-ms 50] [--jitter-ms 0] [--slow-rate 0] [--slow-ms 2000]"
+                         " [--reply-bytes 0] [--chunks 8] [--chunk-delay-ms 10] [--error-rate 0] [--rate-limit-rate 0]"
+                         " [--retry-delay-ms 1000] [--reject-gzip] [--seed 1]\n";
+            return 1;
+        }
+    }
+
+    std::signal(SIGPIPE, SIG_IGN);
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<uint16_t>(options.port));
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        ::listen(listener, 128) != 0)
+    {
+        std::cerr << "Error: cannot listen on 127.0.0.1:" << options.port << ": " << std::strerror(errno) << "\n";
+        return 1;
+    }
+
+    // --port 0 picks a free port; scripts read it from the first line
+    socklen_t length = sizeof(address);
+    getsockname(listener, reinterpret_cast<sockaddr *>(&address), &length);
+    std::cout << "mock_gemini listening on 127.0.0.1:" << ntohs(address.sin_port) << std::endl;
+
+    for (;;)
+    {
+        int fd = ::accept(listener, nullptr, nullptr);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            std::cerr << "Error: accept failed: " << std::strerror(errno) << "\n";
+            return 1;
+        }
+        std::thread(serve, fd).detach();
+    }
+}
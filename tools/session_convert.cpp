@@ -0,0 +1,43 @@
+// session_convert - convert conversation histories between JSON and the binary session format
+// Usage: session_convert <input> <output> [none|zstd|lz4]
+// The input format is detected from the file contents, the output format from the extension (.gcs = binary).
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "Conversation.h"
+#include "BinarySession.h"
+
+int main(int argc, char **argv)
+{
+    if (argc < 3 || argc > 4)
+    {
+        std::cerr << "Usage: " << argv[0] << " <input> <output> [none|zstd|lz4]\n";
+        return EXIT_FAILURE;
+    }
+
+    Conversation convo;
+    try
+    {
+        convo.setBinaryCompression(argc == 4 ? parseCompression(argv[3]) : defaultCompression());
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    if (!convo.loadFromFile(argv[1]))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (!convo.saveToFile(argv[2]))
+    {
+        std::cerr << "Error: failed to write " << argv[2] << "\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Converted " << convo.size() << " message(s) to " << argv[2] << "\n";
+    return EXIT_SUCCESS;
+}